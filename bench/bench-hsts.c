@@ -0,0 +1,131 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+/*
+ * Measures the lookup of hosts in the HSTS provider with generated files of
+ * different numbers of known hosts and prints the latency percentiles of a
+ * batch of lookups.
+ *
+ * Usage: bench-hsts [hosts...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <src/main.h>
+#include <src/hsts.h>
+#include "bench.h"
+
+extern VbCore vb;
+
+/* number of lookups measured together in one run */
+#define BENCH_BATCH 1000
+
+#ifdef FEATURE_HSTS
+static HSTSProvider *provider;
+static char *hosts[BENCH_BATCH];
+
+static void bench_load(gpointer data)
+{
+    provider = hsts_provider_new();
+}
+
+static void bench_unload(gpointer data)
+{
+    g_object_unref(provider);
+}
+
+static void bench_lookup(gpointer data)
+{
+    for (guint i = 0; i < BENCH_BATCH; i++) {
+        hsts_should_secure_host(provider, hosts[i]);
+    }
+}
+
+/**
+ * Generates the batch of hosts to look up by the printf like format that
+ * gets the number of the host twice.
+ */
+static void set_hosts(guint count, const char *format)
+{
+    for (guint i = 0; i < BENCH_BATCH; i++) {
+        g_free(hosts[i]);
+        hosts[i] = g_strdup_printf(format, i * 7919 % count, i % 97);
+    }
+}
+
+static void bench_hosts(const char *dir, guint count)
+{
+    char *file = g_build_filename(dir, "hsts", NULL);
+    FILE *f    = fopen(file, "w");
+
+    g_assert(f);
+    for (guint i = 0; i < count; i++) {
+        fprintf(f, "host%u.example%u.org\t2100-01-01T00:00:00Z\t%c\n",
+            i, i % 97, i % 2 ? 'y' : 'n');
+    }
+    fclose(f);
+    vb.files[FILES_HSTS] = file;
+
+    bench_run(count, "hsts-load", 10, bench_load, bench_unload, NULL);
+
+    provider = hsts_provider_new();
+    set_hosts(count, "host%u.example%u.org");
+    bench_run(count, "hsts-lookup-known", 100, bench_lookup, NULL, NULL);
+    set_hosts(count, "www.host%u.example%u.org");
+    bench_run(count, "hsts-lookup-subdomain", 100, bench_lookup, NULL, NULL);
+    set_hosts(count, "host%u.other%u.com");
+    bench_run(count, "hsts-lookup-unknown", 100, bench_lookup, NULL, NULL);
+    set_hosts(count, "höst%u.example%u.org");
+    bench_run(count, "hsts-lookup-idn", 100, bench_lookup, NULL, NULL);
+    g_object_unref(provider);
+
+    unlink(file);
+    g_free(file);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    char *dir;
+    guint count;
+
+    dir = g_dir_make_tmp(PROJECT "-bench-XXXXXX", NULL);
+    g_assert(dir);
+
+#ifdef FEATURE_HSTS
+    bench_print_header("hosts");
+    if (argc < 2) {
+        bench_hosts(dir, 1000);
+    }
+    for (int i = 1; i < argc; i++) {
+        if ((count = strtoul(argv[i], NULL, 10))) {
+            bench_hosts(dir, count);
+        }
+    }
+    for (guint i = 0; i < BENCH_BATCH; i++) {
+        g_free(hosts[i]);
+    }
+#endif
+
+    rmdir(dir);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+/*
+ * Measures the history, bookmark and queue stores against generated files
+ * of different sizes and prints the latency percentiles of each operation.
+ *
+ * Usage: bench-stores [lines...]
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <src/main.h>
+#include <src/history.h>
+#include <src/bookmark.h>
+#include <src/completion.h>
+#include <src/util.h>
+#include "bench.h"
+
+extern VbCore vb;
+
+static char *dir;
+static GMainLoop *loop;
+
+/**
+ * Writes a file of given number of lines created by the printf like format
+ * that gets the line number three times.
+ */
+static char *generate_file(const char *name, guint lines, const char *format)
+{
+    char *file = g_build_filename(dir, name, NULL);
+    FILE *f    = fopen(file, "w");
+
+    g_assert(f);
+    for (guint i = 0; i < lines; i++) {
+        fprintf(f, format, i, i % 997, i % 31);
+    }
+    fclose(f);
+
+    return file;
+}
+
+static void remove_file(char *file)
+{
+    unlink(file);
+    g_free(file);
+}
+
+/**
+ * Removes the history file together with the directory of its shards that
+ * are folded into the file by history_cleanup().
+ */
+static void remove_history_file(char *file)
+{
+    char *dir = g_strconcat(file, ".d", NULL);
+
+    rmdir(dir);
+    g_free(dir);
+    remove_file(file);
+}
+
+static void query_result(CompletionQuery *query, GtkListStore *store,
+    gboolean finished, gpointer data)
+{
+    if (finished) {
+        g_main_loop_quit(loop);
+    }
+}
+
+/**
+ * Runs the completion provider like the inputbox completion does and waits
+ * until all items are put into the store.
+ */
+static void run_query(CompletionProviderFunc func, const char *input,
+    gpointer data)
+{
+    GtkListStore *store;
+    CompletionQuery *query;
+
+    store = gtk_list_store_new(COMPLETION_STORE_NUM, G_TYPE_STRING,
+#ifdef FEATURE_TITLE_IN_COMPLETION
+        G_TYPE_STRING,
+#endif
+        G_TYPE_STRING);
+    query = completion_query_start(store, input, func, data, query_result, NULL);
+    g_main_loop_run(loop);
+    completion_query_unref(query);
+    g_object_unref(store);
+}
+
+static void bench_history_init(gpointer data)
+{
+    history_init();
+}
+
+static void bench_history_cleanup(gpointer data)
+{
+    history_cleanup();
+}
+
+static void bench_history_query(gpointer data)
+{
+    run_query(history_query_completion, data, GINT_TO_POINTER(HISTORY_URL));
+}
+
+static void bench_history_list(gpointer data)
+{
+    g_list_free_full(history_get_list(VB_INPUT_COMMAND, data), g_free);
+}
+
+static void bench_history_add(gpointer data)
+{
+    history_add(HISTORY_URL, "http://example.org/added", "Added");
+    history_flush();
+}
+
+static void bench_bookmark_query(gpointer data)
+{
+    run_query(bookmark_query_completion, data, NULL);
+}
+
+static void bench_bookmark_tags(gpointer data)
+{
+    run_query(bookmark_query_tag_completion, data, NULL);
+}
+
+#ifdef FEATURE_QUEUE
+static void bench_queue_pop(gpointer data)
+{
+    int count;
+
+    g_free(bookmark_queue_pop(&count));
+}
+#endif
+
+static void bench_lines(guint lines)
+{
+    guint runs = lines >= 1000000 ? 5 : lines >= 100000 ? 20 : 100;
+
+    vb.files[FILES_HISTORY] = generate_file("history", lines,
+        "http://www.example%u.org/page/%u\tPage %u\t3\t1430000000\n");
+    vb.files[FILES_COMMAND] = generate_file("command", lines,
+        "open http://www.example%u.org/%u/%u\n");
+    vb.files[FILES_SEARCH] = generate_file("search", lines, "term %u %u %u\n");
+    vb.files[FILES_BOOKMARK] = generate_file("bookmark", lines,
+        "http://www.example%u.org/\tBookmark\ttag%u other%u\n");
+#ifdef FEATURE_QUEUE
+    vb.files[FILES_QUEUE] = generate_file("queue", lines,
+        "http://www.example%u.org/queued/%u/%u\n");
+#endif
+    /* keep all generated items in the index */
+    vb.config.history_max = lines;
+
+    bench_run(lines, "history-load", MIN(runs, 10),
+        bench_history_init, bench_history_cleanup, NULL);
+
+    history_init();
+    bench_run(lines, "history-query-all", runs, bench_history_query, NULL, "");
+    bench_run(lines, "history-query-tags", runs, bench_history_query, NULL,
+        "example12 page");
+    bench_run(lines, "history-get-list", runs, bench_history_list, NULL,
+        "open http://www.example1");
+    bench_run(lines, "history-add", runs, bench_history_add, NULL, NULL);
+    history_cleanup();
+
+    bench_run(lines, "bookmark-query", runs, bench_bookmark_query, NULL, "tag1");
+    bench_run(lines, "bookmark-tags", runs, bench_bookmark_tags, NULL, "tag");
+#ifdef FEATURE_QUEUE
+    bench_run(lines, "queue-pop", runs, bench_queue_pop, NULL, NULL);
+#endif
+
+    remove_history_file(vb.files[FILES_HISTORY]);
+    remove_history_file(vb.files[FILES_COMMAND]);
+    remove_history_file(vb.files[FILES_SEARCH]);
+    remove_file(vb.files[FILES_BOOKMARK]);
+#ifdef FEATURE_QUEUE
+    remove_file(vb.files[FILES_QUEUE]);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    guint lines;
+
+    dir = g_dir_make_tmp(PROJECT "-bench-XXXXXX", NULL);
+    g_assert(dir);
+    loop = g_main_loop_new(NULL, false);
+
+    bench_print_header("lines");
+    if (argc < 2) {
+        bench_lines(10000);
+    }
+    for (int i = 1; i < argc; i++) {
+        if ((lines = strtoul(argv[i], NULL, 10))) {
+            bench_lines(lines);
+        }
+    }
+
+    g_main_loop_unref(loop);
+    rmdir(dir);
+    g_free(dir);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+/*
+ * The measuring shared by the benchmarks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench.h"
+
+static int cmp_gint64(const void *a, const void *b);
+
+/**
+ * Prints the header of the columns written by bench_run(). The unit names
+ * what the count of each row is.
+ */
+void bench_print_header(const char *unit)
+{
+    printf("%-8s %-22s %5s %10s %10s %10s %10s\n",
+        unit, "operation", "runs", "p50 us", "p90 us", "p99 us", "max us");
+}
+
+/**
+ * Runs func runs times and prints the percentiles of the needed time. The
+ * optional after function is called after each run without being measured.
+ */
+void bench_run(guint count, const char *name, guint runs, BenchFunc func,
+    BenchFunc after, gpointer data)
+{
+    gint64 *times = g_new(gint64, runs), start;
+
+    for (guint i = 0; i < runs; i++) {
+        start    = g_get_monotonic_time();
+        func(data);
+        times[i] = g_get_monotonic_time() - start;
+        if (after) {
+            after(data);
+        }
+    }
+    qsort(times, runs, sizeof(gint64), cmp_gint64);
+
+    printf("%-8u %-22s %5u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+        " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT "\n",
+        count, name, runs,
+        times[(runs - 1) * 50 / 100], times[(runs - 1) * 90 / 100],
+        times[(runs - 1) * 99 / 100], times[runs - 1]);
+    fflush(stdout);
+    g_free(times);
+}
+
+static int cmp_gint64(const void *a, const void *b)
+{
+    gint64 x = *(const gint64*)a, y = *(const gint64*)b;
+
+    return x < y ? -1 : x > y;
+}
@@ -0,0 +1,31 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <glib.h>
+
+typedef void (*BenchFunc)(gpointer data);
+
+void bench_print_header(const char *unit);
+void bench_run(guint count, const char *name, guint runs, BenchFunc func,
+    BenchFunc after, gpointer data);
+
+#endif /* end of include guard: _BENCH_H */
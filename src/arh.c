@@ -22,27 +22,70 @@
 #ifdef FEATURE_ARH
 #include "ascii.h"
 #include "arh.h"
+#include "main.h"
 #include "util.h"
 
+/* A header that is set by a rule, or removed if the value is NULL. */
 typedef struct {
-    char       *pattern; /* pattern the uri is matched against */
-    GHashTable *headers; /* header list */
+    char *name;
+    char *value;
+} HeaderARH;
+
+typedef struct {
+    char          *pattern; /* pattern the uri is matched against */
+    UtilWildmatch *matcher; /* the compiled pattern */
+    guint         first;    /* index of the first header in ARH.headers */
+    guint         count;    /* number of headers of the rule */
 } MatchARH;
 
-static void marh_free(MatchARH *);
+/* A single pattern of a rule split into the parts that are matched against
+ * the components of the uri. */
+typedef struct {
+    guint         rule;     /* index of the MatchARH in ARH.rules */
+    UtilWildmatch *scheme;  /* NULL matches any scheme */
+    UtilWildmatch *host;    /* NULL if the host is already known to match */
+    UtilWildmatch *path;    /* path and query, NULL matches any */
+    UtilWildmatch *uri;     /* whole uri for patterns that can't be split */
+} PatternARH;
+
+struct _ARH {
+    GArray     *rules;      /* MatchARH in the order they where given */
+    GArray     *headers;    /* HeaderARH of all rules */
+    GHashTable *hosts;      /* PatternARH arrays by host or by .domain for
+                             * patterns with host *.domain */
+    GArray     *others;     /* PatternARH that are tried for every uri */
+};
+
+static void add_rule(ARH *arh, const char *pattern, GHashTable *headers);
+static void add_pattern(ARH *arh, guint rule, const char *pattern);
+static gboolean is_part(const char *start, const char *end);
+static gboolean is_literal(const char *pattern);
+static gboolean is_any(const char *pattern);
+static void match_patterns(GArray *list, SoupURI *suri, const char *host,
+    const char *path, char **uri, gboolean *matched);
+static void free_patterns(GArray *list);
 static char *read_pattern(char **);
 
 
 /**
- * parse the data string to a list of MatchARH
+ * parse the data string to ARH rules
  *
  * pattern name=value[,...]
+ *
+ * Returns NULL if there are no rules or on syntax error.
  */
-GSList *arh_parse(const char *data, const char **error)
+ARH *arh_parse(const char *data, const char **error)
 {
-    GSList *parsed = NULL;
+    ARH *arh;
     GSList *data_list = NULL;
 
+    arh          = g_slice_new(ARH);
+    arh->rules   = g_array_new(false, false, sizeof(MatchARH));
+    arh->headers = g_array_new(false, false, sizeof(HeaderARH));
+    arh->others  = g_array_new(false, false, sizeof(PatternARH));
+    arh->hosts   = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify)free_patterns);
+
     /* parse data as comma separated list
      * of "pattern1 HEADERS-GROUP1","pattern2 HEADERS-GROUP2",... */
     data_list = soup_header_parse_list(data);
@@ -68,27 +111,13 @@ GSList *arh_parse(const char *data, const char **error)
 
         /* check result (need a pattern and at least one header) */
         if (pattern && g_hash_table_size(headers)) {
-            MatchARH *marh = g_slice_new0(MatchARH);
-            marh->pattern = g_strdup(pattern);
-            marh->headers = headers;
-
-            parsed = g_slist_append(parsed, marh);
-
-#ifdef DEBUG
-            PRINT_DEBUG("append pattern='%s' headers[%d]='0x%lx'",
-                   marh->pattern, g_hash_table_size(marh->headers), (long)marh->headers);
-            GHashTableIter iterHeaders;
-            const char *name, *value;
-            g_hash_table_iter_init(&iterHeaders, headers);
-            while (g_hash_table_iter_next(&iterHeaders, (gpointer)&name, (gpointer)&value)) {
-                PRINT_DEBUG(" %s=%s", name, value);
-            }
-#endif
+            add_rule(arh, pattern, headers);
+            soup_header_free_param_list(headers);
         } else {
             /* an error occurs: cleanup */
             soup_header_free_param_list(headers);
             soup_header_free_list(data_list);
-            arh_free(parsed);
+            arh_free(arh);
 
             /* set error if asked */
             if (error != NULL) {
@@ -101,64 +130,307 @@ GSList *arh_parse(const char *data, const char **error)
 
     soup_header_free_list(data_list);
 
-    return parsed;
+    if (!arh->rules->len) {
+        arh_free(arh);
+        return NULL;
+    }
+
+    return arh;
 }
 
 /**
- * free the list of MatchARH
+ * free the ARH rules
  */
-void arh_free(GSList *list)
+void arh_free(ARH *arh)
 {
-    g_slist_free_full(list, (GDestroyNotify)marh_free);
+    MatchARH *marh;
+    HeaderARH *header;
+
+    if (!arh) {
+        return;
+    }
+    for (guint i = 0; i < arh->rules->len; i++) {
+        marh = &g_array_index(arh->rules, MatchARH, i);
+        g_free(marh->pattern);
+        util_wildmatch_free(marh->matcher);
+    }
+    for (guint i = 0; i < arh->headers->len; i++) {
+        header = &g_array_index(arh->headers, HeaderARH, i);
+        g_free(header->name);
+        g_free(header->value);
+    }
+    g_array_free(arh->rules, true);
+    g_array_free(arh->headers, true);
+    g_hash_table_destroy(arh->hosts);
+    free_patterns(arh->others);
+
+    g_slice_free(ARH, arh);
 }
 
 /**
  * append to reponse-header of SoupMessage,
- * the header that match the specified uri
+ * the header that match the uri of the message
  */
-void arh_run(GSList *list, const char *uri, SoupMessage *msg)
+void arh_run(ARH *arh, SoupMessage *msg)
 {
-    PRINT_DEBUG("uri: %s", uri);
-
-    /* walk thought the list */
-    for (GSList *l=list; l; l = g_slist_next(l)) {
-        MatchARH *marh = (MatchARH *)l->data;
-
-        if (util_wildmatch(marh->pattern, uri)) {
-            GHashTableIter iter;
-            const char *name  = NULL;
-            const char *value = NULL;
-
-            g_hash_table_iter_init(&iter, marh->headers);
-            while (g_hash_table_iter_next(&iter, (gpointer)&name, (gpointer)&value)) {
-                if (value) {
-                    /* the pattern match, so replace headers
-                     * as side-effect, for one header the last matched will be keeped */
-                    soup_message_headers_replace(msg->response_headers, name, value);
-
-                    PRINT_DEBUG(" header added: %s: %s", name, value);
-                } else {
-                    /* remove a previously setted auto-reponse-header */
-                    soup_message_headers_remove(msg->response_headers, name);
-
-                    PRINT_DEBUG(" header removed: %s", name);
-                }
+    SoupURI *suri;
+    MatchARH *marh;
+    HeaderARH *header;
+    gboolean *matched;
+    char *uri = NULL, *host, *query, *dot;
+    const char *path;
+    gsize len, plen, qlen;
+
+    if (!arh) {
+        return;
+    }
+
+    suri    = soup_message_get_uri(msg);
+    matched = g_newa(gboolean, arh->rules->len);
+    memset(matched, 0, sizeof(gboolean) * arh->rules->len);
+
+    if (!suri->host || suri->user || suri->fragment
+        || strchr(suri->host, ':') || !soup_uri_uses_default_port(suri)
+    ) {
+        /* the uri string has more than scheme, host, path and query - match
+         * the whole patterns against it */
+        uri = soup_uri_to_string(suri, false);
+        for (guint i = 0; i < arh->rules->len; i++) {
+            marh       = &g_array_index(arh->rules, MatchARH, i);
+            matched[i] = util_wildmatch_exec(marh->matcher, uri);
+        }
+    } else {
+        /* hosts are case insensitive but the table holds them lowercase */
+        len  = strlen(suri->host);
+        host = g_newa(char, len + 1);
+        for (gsize i = 0; i <= len; i++) {
+            host[i] = g_ascii_tolower(suri->host[i]);
+        }
+
+        /* the path patterns match also the query like in the uri string */
+        path = suri->path ? suri->path : "";
+        if (suri->query) {
+            plen  = strlen(path);
+            qlen  = strlen(suri->query);
+            query = g_newa(char, plen + qlen + 2);
+            memcpy(query, path, plen);
+            query[plen] = '?';
+            memcpy(query + plen + 1, suri->query, qlen + 1);
+            path = query;
+        }
+
+        match_patterns(g_hash_table_lookup(arh->hosts, host), suri, host, path, &uri, matched);
+        /* try the rules for *.domain for all the domains of the host */
+        for (dot = strchr(host, '.'); dot; dot = strchr(dot + 1, '.')) {
+            match_patterns(g_hash_table_lookup(arh->hosts, dot), suri, host, path, &uri, matched);
+        }
+        match_patterns(arh->others, suri, host, path, &uri, matched);
+    }
+
+    /* apply the headers in the order of the rules, so that the last matched
+     * rule wins for each header */
+    for (guint i = 0; i < arh->rules->len; i++) {
+        if (!matched[i]) {
+            continue;
+        }
+        marh = &g_array_index(arh->rules, MatchARH, i);
+        PRINT_DEBUG("pattern '%s' matched", marh->pattern);
+        for (guint j = marh->first; j < marh->first + marh->count; j++) {
+            header = &g_array_index(arh->headers, HeaderARH, j);
+            if (header->value) {
+                soup_message_headers_replace(msg->response_headers, header->name, header->value);
+
+                PRINT_DEBUG(" header added: %s: %s", header->name, header->value);
+            } else {
+                /* remove a previously setted auto-reponse-header */
+                soup_message_headers_remove(msg->response_headers, header->name);
+
+                PRINT_DEBUG(" header removed: %s", header->name);
             }
         }
     }
+
+    g_free(uri);
 }
 
 /**
- * free a MatchARH
+ * Adds a rule with the headers to set and its patterns.
  */
-static void marh_free(MatchARH *marh)
+static void add_rule(ARH *arh, const char *pattern, GHashTable *headers)
 {
-    if (marh) {
-        g_free(marh->pattern);
-        soup_header_free_param_list(marh->headers);
+    MatchARH marh;
+    HeaderARH header;
+    GHashTableIter iter;
+    const char *name, *value;
+    char **parts;
+
+    marh.pattern = g_strdup(pattern);
+    marh.matcher = util_wildmatch_compile(pattern);
+    marh.first   = arh->headers->len;
+
+    g_hash_table_iter_init(&iter, headers);
+    while (g_hash_table_iter_next(&iter, (gpointer)&name, (gpointer)&value)) {
+        header.name  = g_strdup(name);
+        header.value = g_strdup(value);
+        g_array_append_val(arh->headers, header);
+    }
+    marh.count = arh->headers->len - marh.first;
+    g_array_append_val(arh->rules, marh);
+
+    PRINT_DEBUG("append pattern='%s' headers[%u]", marh.pattern, marh.count);
+
+    parts = util_wildmatch_split(pattern);
+    for (char **part = parts; *part; part++) {
+        add_pattern(arh, arh->rules->len - 1, *part);
+    }
+    g_strfreev(parts);
+}
+
+/**
+ * Adds a single pattern of a rule. Patterns of the form scheme://host/path
+ * are split into matchers for the components of the uri, and stored by their
+ * host if this has no wildcard, or is of the form *.domain.
+ */
+static void add_pattern(ARH *arh, guint rule, const char *pattern)
+{
+    PatternARH pat = {rule};
+    const char *host, *path;
+    char *part, *key = NULL;
+    GArray *list;
+
+    /* a pattern like '*' matches any uri */
+    if (is_any(pattern)) {
+        g_array_append_val(arh->others, pat);
+        return;
+    }
+
+    host = strstr(pattern, "://");
+    if (!host || !is_part(pattern, host)) {
+        goto whole;
+    }
+    host += 3;
+    path  = host + strcspn(host, "/");
+    if (!is_part(host, path)) {
+        goto whole;
+    }
+
+    part = g_strndup(pattern, host - 3 - pattern);
+    if (!is_any(part)) {
+        pat.scheme = util_wildmatch_compile(part);
+    }
+    g_free(part);
+
+    part = g_strndup(host, path - host);
+    /* a '*' at the end of the host matches also any path */
+    if (*path || !g_str_has_suffix(part, "*") || g_str_has_suffix(part, "\\*")) {
+        pat.path = util_wildmatch_compile(path);
+    }
+    if (is_literal(part)) {
+        key = g_ascii_strdown(part, -1);
+    } else if (part[0] == '*' && part[1] == '.' && is_literal(part + 2)) {
+        key = g_ascii_strdown(part + 1, -1);
+    } else if (!is_any(part)) {
+        pat.host = util_wildmatch_compile(part);
+    }
+    g_free(part);
+
+    if (key) {
+        if (!(list = g_hash_table_lookup(arh->hosts, key))) {
+            list = g_array_new(false, false, sizeof(PatternARH));
+            g_hash_table_insert(arh->hosts, key, list);
+        } else {
+            g_free(key);
+        }
+        g_array_append_val(list, pat);
+    } else {
+        g_array_append_val(arh->others, pat);
+    }
+    return;
 
-        g_slice_free(MatchARH, marh);
+whole:
+    pat.uri = util_wildmatch_compile(pattern);
+    g_array_append_val(arh->others, pat);
+}
+
+/**
+ * Checks if the part of a pattern between start and end can be matched
+ * against a single component of the uri.
+ */
+static gboolean is_part(const char *start, const char *end)
+{
+    int braces = 0;
+
+    for (const char *p = start; p < end; p++) {
+        if (*p == ':' || *p == '/' || (*p == '}' && --braces < 0)) {
+            return false;
+        }
+        if (*p == '{') {
+            braces++;
+        }
+    }
+
+    return !braces && (end == start || *(end - 1) != '\\');
+}
+
+static gboolean is_literal(const char *pattern)
+{
+    return !pattern[strcspn(pattern, "*?{}\\")];
+}
+
+static gboolean is_any(const char *pattern)
+{
+    return *pattern == '*' && !pattern[strspn(pattern, "*")];
+}
+
+/**
+ * Marks the rules of the patterns that match the uri.
+ */
+static void match_patterns(GArray *list, SoupURI *suri, const char *host,
+    const char *path, char **uri, gboolean *matched)
+{
+    PatternARH *pat;
+
+    if (!list) {
+        return;
+    }
+    for (guint i = 0; i < list->len; i++) {
+        pat = &g_array_index(list, PatternARH, i);
+        if (matched[pat->rule]) {
+            continue;
+        }
+        if (pat->uri) {
+            if (!*uri) {
+                *uri = soup_uri_to_string(suri, false);
+            }
+            matched[pat->rule] = util_wildmatch_exec(pat->uri, *uri);
+        } else {
+            matched[pat->rule] = (!pat->scheme || util_wildmatch_exec(pat->scheme, suri->scheme))
+                && (!pat->host || util_wildmatch_exec(pat->host, host))
+                && (!pat->path || util_wildmatch_exec(pat->path, path));
+        }
+    }
+}
+
+static void free_patterns(GArray *list)
+{
+    PatternARH *pat;
+
+    for (guint i = 0; i < list->len; i++) {
+        pat = &g_array_index(list, PatternARH, i);
+        if (pat->scheme) {
+            util_wildmatch_free(pat->scheme);
+        }
+        if (pat->host) {
+            util_wildmatch_free(pat->host);
+        }
+        if (pat->path) {
+            util_wildmatch_free(pat->path);
+        }
+        if (pat->uri) {
+            util_wildmatch_free(pat->uri);
+        }
     }
+    g_array_free(list, true);
 }
 
 /**
@@ -24,11 +24,15 @@
 #ifndef _ARH_H
 #define _ARH_H
 
-#include "main.h"
+#include <glib.h>
+#include <libsoup/soup.h>
 
-GSList *arh_parse(const char *, const char **);
-void    arh_free(GSList *);
-void    arh_run(GSList *, const char *, SoupMessage *);
+/* Compiled auto-response-header rules. */
+typedef struct _ARH ARH;
+
+ARH  *arh_parse(const char *, const char **);
+void arh_free(ARH *);
+void arh_run(ARH *, SoupMessage *);
 
 #endif /* end of include guard: _ARH_H */
 #endif
@@ -28,14 +28,27 @@
 typedef struct {
     guint bits;     /* the bits identify the events the command applies to */
     char *excmd;    /* ex command string to be run on matches event */
+    ExCmd *parsed;  /* the parsed excmd */
     char *pattern;  /* list of patterns the uri is matched agains */
+    guint refs;     /* held by the group and the dispatch */
 } AutoCmd;
 
 typedef struct {
     char    *name;
     GSList  *cmds;
+    guint   refs;   /* held by the group list and the dispatch */
 } AuGroup;
 
+/* All commands of an event in the order they are run with their patterns
+ * compiled together, so that the uri is matched only once per event. The
+ * arrays hold a reference on the commands and groups, so that a running
+ * dispatch outlives the changes made by its commands. */
+typedef struct {
+    GPtrArray     *cmds;
+    GPtrArray     *groups;  /* the group of each of the commands */
+    UtilWildmatch *matcher;
+} AuDispatch;
+
 static struct {
     const char *name;
     guint      bits;
@@ -56,14 +69,20 @@ extern VbCore vb;
 static AuGroup *curgroup = NULL;
 static GSList  *groups   = NULL;
 static guint   usedbits  = 0;       /* holds all used event bits */
+static AuDispatch dispatch[LENGTH(events)];
+static gboolean changed  = false;   /* dispatch must be rebuilt */
 
 static GSList *get_group(const char *name);
 static guint get_event_bits(const char *name);
 static void rebuild_used_bits(void);
+static void rebuild_dispatch(void);
+static void free_dispatch(void);
 static char *get_next_word(char **line);
 static AuGroup *new_group(const char *name);
+static AuGroup *ref_group(AuGroup *group);
 static void free_group(AuGroup *group);
 static AutoCmd *new_autocmd(const char *excmd, const char *pattern);
+static AutoCmd *ref_autocmd(AutoCmd *cmd);
 static void free_autocmd(AutoCmd *cmd);
 
 
@@ -75,6 +94,7 @@ void autocmd_init(void)
 
 void autocmd_cleanup(void)
 {
+    free_dispatch();
     if (groups) {
         g_slist_free_full(groups, (GDestroyNotify)free_group);
     }
@@ -117,6 +137,7 @@ gboolean autocmd_augroup(char *name, gboolean delete)
 
         /* there where autocmds remove - so recreate the usedbits */
         rebuild_used_bits();
+        changed = true;
 
         return true;
     }
@@ -221,6 +242,7 @@ gboolean autocmd_add(char *name, gboolean delete)
         /* if ther was at least one command removed - rebuilt the used bits */
         if (removed) {
             rebuild_used_bits();
+            changed = true;
         }
 
         return true;
@@ -236,6 +258,7 @@ gboolean autocmd_add(char *name, gboolean delete)
 
         /* merge the autocmd bits into the used bits */
         usedbits |= cmd->bits;
+        changed   = true;
     }
 
     return true;
@@ -246,9 +269,10 @@ gboolean autocmd_add(char *name, gboolean delete)
  */
 gboolean autocmd_run(AuEvent event, const char *uri, const char *group)
 {
-    GSList  *lg, *lc;
+    AuDispatch *disp;
     AuGroup *grp;
-    AutoCmd *cmd;
+    GPtrArray *cmds, *grps;
+    gboolean *matches = NULL;
     guint bits = events[event].bits;
 
     /* if there is no autocmd for this event - skip here */
@@ -256,31 +280,41 @@ gboolean autocmd_run(AuEvent event, const char *uri, const char *group)
         return true;
     }
 
-    /* loop over the groups and find matching commands */
-    for (lg = groups; lg; lg = lg->next) {
-        grp = lg->data;
+    /* the dispatch is built only for the first run after the commands
+     * changed, so that sourcing many autocmds does not rebuild it each time */
+    if (changed) {
+        rebuild_dispatch();
+    }
+    disp = &dispatch[event];
+
+    /* check pattern only if uri was given */
+    if (uri) {
+        matches = g_newa(gboolean, disp->cmds->len);
+        if (!util_wildmatch_exec_all(disp->matcher, uri, matches)) {
+            return true;
+        }
+    }
+
+    /* the commands may change the autocmds and so rebuild the dispatch */
+    cmds = g_ptr_array_ref(disp->cmds);
+    grps = g_ptr_array_ref(disp->groups);
+    for (guint i = 0; i < cmds->len; i++) {
+        grp = g_ptr_array_index(grps, i);
         /* if a group was given - skip all none matching groupes */
         if (group && strcmp(group, grp->name)) {
             continue;
         }
-        /* test each command in group */
-        for (lc = grp->cmds; lc; lc = lc->next) {
-            cmd = lc->data;
-            /* skip if this dos not match the event bits */
-            if (!(bits & cmd->bits)) {
-                continue;
-            }
-            /* check pattern only if uri was given */
-            /* skip if pattern does not match */
-            if (uri && !util_wildmatch(cmd->pattern, uri)) {
-                continue;
-            }
-            /* run the command */
-            /* TODO shoult the result be tested for RESULT_COMPLETE? */
-            /* run command and make sure it's not writte to command history */
-            ex_run_string(cmd->excmd, false);
+        /* skip if pattern does not match */
+        if (matches && !matches[i]) {
+            continue;
         }
+        /* run the command */
+        /* TODO shoult the result be tested for RESULT_COMPLETE? */
+        /* run command and make sure it's not writte to command history */
+        ex_cmd_run(((AutoCmd*)g_ptr_array_index(cmds, i))->parsed);
     }
+    g_ptr_array_unref(cmds);
+    g_ptr_array_unref(grps);
 
     return true;
 }
@@ -419,6 +453,56 @@ static void rebuild_used_bits(void)
     }
 }
 
+/**
+ * Collects the commands of each event from all groups and compiles their
+ * patterns into one matcher per event.
+ */
+static void rebuild_dispatch(void)
+{
+    GSList *lg, *lc;
+    GPtrArray *patterns;
+    AutoCmd *cmd;
+    AuDispatch *disp;
+
+    free_dispatch();
+    patterns = g_ptr_array_new();
+    for (int i = 0; i < LENGTH(events); i++) {
+        disp         = &dispatch[i];
+        disp->cmds   = g_ptr_array_new_with_free_func((GDestroyNotify)free_autocmd);
+        disp->groups = g_ptr_array_new_with_free_func((GDestroyNotify)free_group);
+        g_ptr_array_set_size(patterns, 0);
+
+        for (lg = groups; lg; lg = lg->next) {
+            for (lc = ((AuGroup*)lg->data)->cmds; lc; lc = lc->next) {
+                cmd = lc->data;
+                if (!(cmd->bits & events[i].bits)) {
+                    continue;
+                }
+                g_ptr_array_add(disp->cmds, ref_autocmd(cmd));
+                g_ptr_array_add(disp->groups, ref_group(lg->data));
+                g_ptr_array_add(patterns, cmd->pattern);
+            }
+        }
+        disp->matcher = util_wildmatch_compile_all(
+            (const char**)patterns->pdata, patterns->len
+        );
+    }
+    g_ptr_array_free(patterns, true);
+    changed = false;
+}
+
+static void free_dispatch(void)
+{
+    for (int i = 0; i < LENGTH(events); i++) {
+        if (dispatch[i].matcher) {
+            g_ptr_array_unref(dispatch[i].cmds);
+            g_ptr_array_unref(dispatch[i].groups);
+            util_wildmatch_free(dispatch[i].matcher);
+            dispatch[i].matcher = NULL;
+        }
+    }
+}
+
 /**
  * Get the next word from given line.
  * Given line pointer is set past the word and and a 0-byte is added there.
@@ -457,12 +541,23 @@ static AuGroup *new_group(const char *name)
     AuGroup *new = g_slice_new(AuGroup);
     new->name    = g_strdup(name);
     new->cmds    = NULL;
+    new->refs    = 1;
 
     return new;
 }
 
+static AuGroup *ref_group(AuGroup *group)
+{
+    group->refs++;
+
+    return group;
+}
+
 static void free_group(AuGroup *group)
 {
+    if (--group->refs) {
+        return;
+    }
     g_free(group->name);
     if (group->cmds) {
         g_slist_free_full(group->cmds, (GDestroyNotify)free_autocmd);
@@ -474,13 +569,26 @@ static AutoCmd *new_autocmd(const char *excmd, const char *pattern)
 {
     AutoCmd *new = g_slice_new(AutoCmd);
     new->excmd   = g_strdup(excmd);
+    new->parsed  = ex_cmd_compile(excmd);
     new->pattern = g_strdup(pattern);
+    new->refs    = 1;
     return new;
 }
 
+static AutoCmd *ref_autocmd(AutoCmd *cmd)
+{
+    cmd->refs++;
+
+    return cmd;
+}
+
 static void free_autocmd(AutoCmd *cmd)
 {
+    if (--cmd->refs) {
+        return;
+    }
     g_free(cmd->excmd);
+    ex_cmd_free(cmd->parsed);
     g_free(cmd->pattern);
     g_slice_free(AutoCmd, cmd);
 }
@@ -18,172 +18,270 @@
  */
 
 #include "config.h"
+#include <unistd.h>
 #include "main.h"
 #include "bookmark.h"
 #include "util.h"
 #include "completion.h"
+#ifdef FEATURE_SHARED_STORE
+#include "store.h"
+#endif
 
 extern VbCore vb;
 
+/* prefix of the lines that remove all bookmarks of the following URI */
+#define BOOKMARK_TOMBSTONE '-'
+/* the bookmark file is compacted if it has that many times more lines than
+ * bookmarks but not before it has COMPACT_MIN_LINES lines */
+#define COMPACT_RATIO 2
+#define COMPACT_MIN_LINES 100
+/* minimum number of postings of removed bookmarks before the tag index is
+ * rebuilt */
+#define TAG_STALE_MIN 256
+
+#ifdef FEATURE_QUEUE
+/* The queue file is a journal. Lines with an URI push it to the end of the
+ * queue, lines prefixed by QUEUE_UNSHIFT put it to the beginning and a line
+ * of QUEUE_POP removes the first entry. */
+#define QUEUE_UNSHIFT '+'
+#define QUEUE_POP     '-'
+/* attempts to clear the queue while other instances append to it */
+#define QUEUE_CLEAR_TRIES 10
+#endif
+
 typedef struct {
-    char *uri;
-    char *title;
-    char *tags;
+    char  *uri;
+    char  *title;
+    char  *tags;
+    GList *link;    /* link of the bookmark in the items queue */
+    guint id;       /* increasing id used in the tag postings */
 } Bookmark;
 
-static GList *load(const char *file);
-static gboolean bookmark_contains_all_tags(Bookmark *bm, char **query,
+typedef struct {
+    char   *name;
+    GArray *postings;   /* ascending ids of the bookmarks with this tag */
+    guint  count;       /* number of not removed bookmarks with this tag */
+} Tag;
+
+static void get_index(void);
+static void index_parse(char *content);
+static void index_insert(Bookmark *bm);
+static gboolean index_remove(const char *uri);
+static void index_clear(void);
+static void compact(void);
+static void tag_add(Bookmark *bm);
+static void tag_remove(Bookmark *bm);
+static void tag_rebuild(void);
+static void tag_range(const char *prefix, guint *start, guint *end);
+static GArray *tag_lookup(const char *prefix);
+static GArray *tag_intersect(GArray *a, GArray *b);
+static int tag_cmp(gconstpointer a, gconstpointer b);
+static int id_cmp(gconstpointer a, gconstpointer b);
+static void free_tag(Tag *tag);
+#ifdef FEATURE_QUEUE
+static void get_queue(void);
+static void queue_parse(char *content);
+static void queue_compact(void);
+#endif
+static gboolean bookmark_contains_all_tags(const char *tags, char **query,
     unsigned int qlen);
-static Bookmark *line_to_bookmark(const char *uri, const char *data);
+static gboolean match_tags(const char *first, const char *tags, char **query);
+static Bookmark *line_to_bookmark(const char *uri, char *data);
 static void free_bookmark(Bookmark *bm);
 
+/* The bookmarks of the bookmark file. The file is a journal, new bookmarks
+ * and tombstones of removed ones are appended and replayed into the index. */
+static struct {
+    GQueue        *items;   /* bookmarks in the order they where saved */
+    GHashTable    *lookup;  /* maps the URIs to the bookmarks */
+    UtilFileState state;    /* the part of the file read into the index */
+    guint         lines;    /* lines in the file including tombstones */
+    GHashTable    *ids;     /* maps the ids to the bookmarks */
+    GHashTable    *tags;    /* maps the tag names to the Tag entries */
+    GPtrArray     *dict;    /* all Tag entries, sorted by name if sorted */
+    gboolean      sorted;
+    guint         nextid;
+    guint         stale;    /* postings of removed bookmarks */
+} bookmarks;
+/* guards the index against the completion running in worker threads */
+G_LOCK_DEFINE_STATIC(bookmarks);
+
+#ifdef FEATURE_QUEUE
+/* the URIs of the queue replayed from the queue file */
+static struct {
+    GQueue        *items;
+    UtilFileState state;
+    guint         lines;    /* lines in the file including pops */
+} queue;
+#endif
+
 /**
  * Write a new bookmark entry to the end of bookmark file.
  */
 gboolean bookmark_add(const char *uri, const char *title, const char *tags)
 {
     const char *file = vb.files[FILES_BOOKMARK];
+    gboolean res;
+
     if (tags) {
-        return util_file_append(file, "%s\t%s\t%s\n", uri, title ? title : "", tags);
-    }
-    if (title) {
-        return util_file_append(file, "%s\t%s\n", uri, title);
+        res = util_file_append(file, "%s\t%s\t%s\n", uri, title ? title : "", tags);
+    } else if (title) {
+        res = util_file_append(file, "%s\t%s\n", uri, title);
+    } else {
+        res = util_file_append(file, "%s\n", uri);
     }
-    return util_file_append(file, "%s\n", uri);
+
+    /* the new line is replayed into the index on next access */
+    return res;
 }
 
+/**
+ * Removes all bookmarks of given URI by appending a tombstone to the
+ * bookmark file.
+ */
 gboolean bookmark_remove(const char *uri)
 {
-    char **lines, *line, *p;
-    int len, i;
-    GString *new;
     gboolean removed = false;
 
     if (!uri) {
         return false;
     }
 
-    lines = util_get_lines(vb.files[FILES_BOOKMARK]);
-    if (lines) {
-        new = g_string_new(NULL);
-        len = g_strv_length(lines) - 1;
-        for (i = 0; i < len; i++) {
-            line = lines[i];
-            g_strstrip(line);
-            /* ignore the title or bookmark tags and test only the uri */
-            if ((p = strchr(line, '\t'))) {
-                *p = '\0';
-                if (!strcmp(uri, line)) {
-                    removed = true;
-                    continue;
-                } else {
-                    /* reappend the tags */
-                    *p = '\t';
-                }
-            }
-            if (!strcmp(uri, line)) {
-                removed = true;
-                continue;
-            }
-            g_string_append_printf(new, "%s\n", line);
-        }
-        g_strfreev(lines);
-        g_file_set_contents(vb.files[FILES_BOOKMARK], new->str, -1, NULL);
-        g_string_free(new, true);
+    G_LOCK(bookmarks);
+    get_index();
+    if (g_hash_table_contains(bookmarks.lookup, uri)
+        && util_file_append(vb.files[FILES_BOOKMARK], "%c%s\n", BOOKMARK_TOMBSTONE, uri)
+    ) {
+        /* replay the tombstone like the lines of other instances */
+        get_index();
+        removed = true;
     }
+    G_UNLOCK(bookmarks);
 
     return removed;
 }
 
-gboolean bookmark_fill_completion(GtkListStore *store, const char *input)
+/**
+ * Frees the bookmark index and the queue.
+ */
+void bookmark_cleanup(void)
+{
+    G_LOCK(bookmarks);
+    if (bookmarks.items) {
+        index_clear();
+        g_queue_free(bookmarks.items);
+        g_hash_table_destroy(bookmarks.lookup);
+        g_hash_table_destroy(bookmarks.ids);
+        g_hash_table_destroy(bookmarks.tags);
+        g_ptr_array_unref(bookmarks.dict);
+        bookmarks.items  = NULL;
+        bookmarks.lookup = NULL;
+        memset(&bookmarks.state, 0, sizeof(UtilFileState));
+    }
+    G_UNLOCK(bookmarks);
+#ifdef FEATURE_QUEUE
+    if (queue.items) {
+        g_queue_free_full(queue.items, g_free);
+        queue.items = NULL;
+        queue.lines = 0;
+        memset(&queue.state, 0, sizeof(UtilFileState));
+    }
+#endif
+}
+
+/**
+ * Completion provider that adds all bookmarks having all the tags given by
+ * input. This is run in a worker thread.
+ */
+void bookmark_query_completion(CompletionQuery *query, const char *input,
+    gpointer data)
 {
-    gboolean found = false;
     char **parts;
-    unsigned int len;
-    GtkTreeIter iter;
-    GList *src = NULL;
+    GArray *ids = NULL;
     Bookmark *bm;
 
-    src = load(vb.files[FILES_BOOKMARK]);
-    src = g_list_reverse(src);
-    if (!input || !*input) {
-        /* without any tags return all bookmarked items */
-        for (GList *l = src; l; l = l->next) {
-            bm = (Bookmark*)l->data;
-            gtk_list_store_append(store, &iter);
-            gtk_list_store_set(
-                store, &iter,
-                COMPLETION_STORE_FIRST, bm->uri,
-#ifdef FEATURE_TITLE_IN_COMPLETION
-                COMPLETION_STORE_SECOND, bm->title,
+#ifdef FEATURE_SHARED_STORE
+    if (store_query(query, STORE_BOOKMARK, 0, input)) {
+        return;
+    }
 #endif
-                -1
-            );
-            found = true;
-        }
-    } else {
-        parts = g_strsplit(input, " ", 0);
-        len   = g_strv_length(parts);
 
-        for (GList *l = src; l; l = l->next) {
+    parts = g_strsplit(input ? input : "", " ", 0);
+
+    G_LOCK(bookmarks);
+    get_index();
+    if (!*parts) {
+        /* without any tags return all bookmarked items, newest first */
+        for (GList *l = bookmarks.items->tail; l && !completion_query_cancelled(query); l = l->prev) {
             bm = (Bookmark*)l->data;
-            if (bookmark_contains_all_tags(bm, parts, len)) {
-                gtk_list_store_append(store, &iter);
-                gtk_list_store_set(
-                    store, &iter,
-                    COMPLETION_STORE_FIRST, bm->uri,
-#ifdef FEATURE_TITLE_IN_COMPLETION
-                    COMPLETION_STORE_SECOND, bm->title,
-#endif
-                    -1
-                );
-                found = true;
-            }
+            completion_query_add(query, bm->uri, bm->title, bm->tags);
         }
+        G_UNLOCK(bookmarks);
         g_strfreev(parts);
+
+        return;
     }
 
-    g_list_free_full(src, (GDestroyNotify)free_bookmark);
+    /* intersect the bookmarks of the tags starting with each query part */
+    for (char **part = parts; *part && (!ids || ids->len); part++) {
+        ids = tag_intersect(ids, tag_lookup(*part));
+    }
+    /* the ids increase with each saved bookmark, so the highest is the
+     * newest one */
+    for (guint i = ids->len; i > 0 && !completion_query_cancelled(query); i--) {
+        bm = g_hash_table_lookup(bookmarks.ids, GUINT_TO_POINTER(g_array_index(ids, guint, i - 1)));
+        /* postings may still refer to removed bookmarks */
+        if (bm) {
+            completion_query_add(query, bm->uri, bm->title, bm->tags);
+        }
+    }
+    G_UNLOCK(bookmarks);
 
-    return found;
+    g_array_free(ids, true);
+    g_strfreev(parts);
 }
 
-gboolean bookmark_fill_tag_completion(GtkListStore *store, const char *input)
+/**
+ * Removes the items from the store of a previous bookmark_query_completion()
+ * that do not match all tags of given input.
+ */
+gboolean bookmark_narrow_completion(GtkListStore *store, const char *input)
 {
-    gboolean found;
-    unsigned int len, i;
-    char **tags, *tag;
-    GList *src = NULL, *taglist = NULL;
-    Bookmark *bm;
+    char **parts = g_strsplit(input, " ", 0);
 
-    /* get all distinct tags from bookmark file */
-    src = load(vb.files[FILES_BOOKMARK]);
-    for (GList *l = src; l; l = l->next) {
-        bm = (Bookmark*)l->data;
-        /* if bookmark contains no tags we can go to the next bookmark */
-        if (!bm->tags) {
-            continue;
-        }
+    completion_narrow(store, (CompletionMatchFunc)match_tags, parts);
+    g_strfreev(parts);
 
-        tags = g_strsplit(bm->tags, " ", -1);
-        len  = g_strv_length(tags);
-        for (i = 0; i < len; i++) {
-            tag = tags[i];
-            /* add tag only if it isn't already in the list */
-            if (!g_list_find_custom(taglist, tag, (GCompareFunc)strcmp)) {
-                taglist = g_list_prepend(taglist, g_strdup(tag));
-            }
-        }
-        g_strfreev(tags);
-    }
+    return true;
+}
 
-    /* generate the completion with the found tags */
-    found = util_fill_completion(store, input, taglist);
+/**
+ * Completion provider for the distinct bookmark tags starting with input.
+ * This is run in a worker thread.
+ */
+void bookmark_query_tag_completion(CompletionQuery *query, const char *input,
+    gpointer data)
+{
+    guint start, end;
+    Tag *tag;
 
-    g_list_free_full(src, (GDestroyNotify)free_bookmark);
-    g_list_free_full(taglist, (GDestroyNotify)g_free);
+#ifdef FEATURE_SHARED_STORE
+    if (store_query(query, STORE_BOOKMARK_TAG, 0, input)) {
+        return;
+    }
+#endif
 
-    return found;
+    G_LOCK(bookmarks);
+    get_index();
+    tag_range(input ? input : "", &start, &end);
+    for (guint i = start; i < end && !completion_query_cancelled(query); i++) {
+        tag = g_ptr_array_index(bookmarks.dict, i);
+        /* skip the tags of removed bookmarks */
+        if (tag->count) {
+            completion_query_add(query, tag->name, NULL, NULL);
+        }
+    }
+    G_UNLOCK(bookmarks);
 }
 
 #ifdef FEATURE_QUEUE
@@ -204,7 +302,7 @@ gboolean bookmark_queue_push(const char *uri)
  */
 gboolean bookmark_queue_unshift(const char *uri)
 {
-    return util_file_prepend(vb.files[FILES_QUEUE], "%s\n", uri);
+    return util_file_append(vb.files[FILES_QUEUE], "%c%s\n", QUEUE_UNSHIFT, uri);
 }
 
 /**
@@ -215,28 +313,31 @@ gboolean bookmark_queue_unshift(const char *uri)
  */
 char *bookmark_queue_pop(int *item_count)
 {
-    int len, i;
-    char **lines, *uri = NULL;
-
-    lines = util_get_lines(vb.files[FILES_QUEUE]);
-    if (lines && (len = g_strv_length(lines))) {
-        GString *new = g_string_new(NULL);
-
-        uri = g_strdup(lines[0]);
-        /* don't process last empty line */
-        len -= 1;
-        /* skip the first list that should be removed */
-        for (i = 1; i < len; i++) {
-            g_string_append_printf(new, "%s\n", lines[i]);
+    const char pop[] = {QUEUE_POP, '\n'};
+    char *uri = NULL;
+    int fd;
+
+    /* The head is read and the pop is appended under one lock, so that no
+     * other instance can pop the same entry in between. */
+    if ((fd = util_file_lock(vb.files[FILES_QUEUE])) != -1) {
+        get_queue();
+        if (!g_queue_is_empty(queue.items) && write(fd, pop, sizeof(pop)) == sizeof(pop)) {
+            uri = g_strdup(g_queue_peek_head(queue.items));
         }
-        g_strfreev(lines);
-        g_file_set_contents(vb.files[FILES_QUEUE], new->str, -1, NULL);
-        g_string_free(new, true);
-
-        *item_count = len - 1;
-    } else {
-        *item_count = 0;
+        close(fd);
+    }
+    /* replay the pop like the lines of other instances */
+    get_queue();
+    *item_count = g_queue_get_length(queue.items);
+
+    /* popped entries and pops are kept in the file until it is compacted,
+     * this must not be done under the lock of the file */
+    if (queue.lines >= COMPACT_MIN_LINES
+        && queue.lines > queue.items->length * COMPACT_RATIO
+    ) {
+        queue_compact();
     }
+
     return uri;
 }
 
@@ -245,20 +346,417 @@ char *bookmark_queue_pop(int *item_count)
  */
 gboolean bookmark_queue_clear(void)
 {
-    FILE *f;
-    if ((f = fopen(vb.files[FILES_QUEUE], "w"))) {
-        fclose(f);
-        return true;
+    /* The file is replaced only if nothing was appended since it was read,
+     * so it is read again if another instance was faster. Replacing it
+     * instead of truncating it lets the other instances notice the new file
+     * by its inode. */
+    for (int i = 0; i < QUEUE_CLEAR_TRIES; i++) {
+        get_queue();
+        if (util_file_replace(vb.files[FILES_QUEUE], "", 0, &queue.state)) {
+            g_queue_foreach(queue.items, (GFunc)g_free, NULL);
+            g_queue_clear(queue.items);
+            queue.lines = 0;
+
+            return true;
+        }
     }
+
     return false;
 }
 #endif /* FEATURE_QUEUE */
 
-static GList *load(const char *file)
+/**
+ * Replays the lines appended to the bookmark file since the last call into
+ * the index. The caller must hold the bookmarks lock.
+ */
+static void get_index(void)
+{
+    UtilFileChange change;
+    char *content;
+
+    if (!bookmarks.items) {
+        bookmarks.items  = g_queue_new();
+        bookmarks.lookup = g_hash_table_new(g_str_hash, g_str_equal);
+        bookmarks.ids    = g_hash_table_new(g_direct_hash, g_direct_equal);
+        bookmarks.tags   = g_hash_table_new(g_str_hash, g_str_equal);
+        bookmarks.dict   = g_ptr_array_new_with_free_func((GDestroyNotify)free_tag);
+    }
+
+    content = util_file_read_new(vb.files[FILES_BOOKMARK], &bookmarks.state, &change);
+    if (change == UTIL_FILE_REPLACED) {
+        index_clear();
+    }
+    if (content) {
+        index_parse(content);
+        g_free(content);
+    }
+
+    /* drop the postings of removed bookmarks if they are too many */
+    if (bookmarks.stale > MAX(TAG_STALE_MIN, bookmarks.items->length)) {
+        tag_rebuild();
+    }
+
+    if (bookmarks.lines >= COMPACT_MIN_LINES
+        && bookmarks.lines > bookmarks.items->length * COMPACT_RATIO
+    ) {
+        compact();
+    }
+}
+
+static void index_parse(char *content)
+{
+    char *line, *next, *data;
+
+    for (line = content; line && *line; line = next) {
+        if ((next = strchr(line, '\n'))) {
+            *next++ = '\0';
+        }
+        g_strstrip(line);
+        if (!*line) {
+            continue;
+        }
+        bookmarks.lines++;
+
+        if (*line == BOOKMARK_TOMBSTONE) {
+            index_remove(line + 1);
+            continue;
+        }
+        /* if line contains tab char - separate the line at this */
+        if ((data = strchr(line, '\t'))) {
+            *data++ = '\0';
+        }
+        index_insert(line_to_bookmark(line, data));
+    }
+}
+
+/**
+ * Adds the bookmark as newest one to the index. A former bookmark of the
+ * same URI is replaced.
+ */
+static void index_insert(Bookmark *bm)
+{
+    index_remove(bm->uri);
+    g_queue_push_tail(bookmarks.items, bm);
+    bm->link = bookmarks.items->tail;
+    bm->id   = bookmarks.nextid++;
+    g_hash_table_insert(bookmarks.lookup, bm->uri, bm);
+    g_hash_table_insert(bookmarks.ids, GUINT_TO_POINTER(bm->id), bm);
+    tag_add(bm);
+}
+
+static gboolean index_remove(const char *uri)
+{
+    Bookmark *bm;
+
+    if (!(bm = g_hash_table_lookup(bookmarks.lookup, uri))) {
+        return false;
+    }
+    g_hash_table_remove(bookmarks.lookup, uri);
+    g_hash_table_remove(bookmarks.ids, GUINT_TO_POINTER(bm->id));
+    g_queue_delete_link(bookmarks.items, bm->link);
+    tag_remove(bm);
+    free_bookmark(bm);
+
+    return true;
+}
+
+static void index_clear(void)
+{
+    g_hash_table_remove_all(bookmarks.lookup);
+    g_hash_table_remove_all(bookmarks.ids);
+    g_hash_table_remove_all(bookmarks.tags);
+    g_ptr_array_set_size(bookmarks.dict, 0);
+    g_queue_foreach(bookmarks.items, (GFunc)free_bookmark, NULL);
+    g_queue_clear(bookmarks.items);
+    bookmarks.lines  = 0;
+    bookmarks.stale  = 0;
+    bookmarks.sorted = true;
+}
+
+/**
+ * Replaces the bookmark file by a file that contains only the bookmarks of
+ * the index, without tombstones and replaced bookmarks. The caller must hold
+ * the bookmarks lock.
+ */
+static void compact(void)
 {
-    return util_file_to_unique_list(file, (Util_Content_Func)line_to_bookmark, 0);
+    GString *content;
+    Bookmark *bm;
+
+    content = g_string_sized_new(bookmarks.state.size);
+    for (GList *l = bookmarks.items->head; l; l = l->next) {
+        bm = (Bookmark*)l->data;
+        g_string_append(content, bm->uri);
+        if (bm->title || bm->tags) {
+            g_string_append_printf(content, "\t%s", bm->title ? bm->title : "");
+        }
+        if (bm->tags) {
+            g_string_append_printf(content, "\t%s", bm->tags);
+        }
+        g_string_append_c(content, '\n');
+    }
+
+    /* a file changed by another instance in the meantime is not replaced */
+    if (util_file_replace(vb.files[FILES_BOOKMARK], content->str, content->len, &bookmarks.state)) {
+        bookmarks.lines = bookmarks.items->length;
+    }
+    g_string_free(content, true);
 }
 
+/**
+ * Adds the id of the bookmark to the postings of each of its tags.
+ */
+static void tag_add(Bookmark *bm)
+{
+    char **names;
+    Tag *tag;
+
+    if (!bm->tags) {
+        return;
+    }
+    names = g_strsplit(bm->tags, " ", -1);
+    for (char **name = names; *name; name++) {
+        if (!**name) {
+            continue;
+        }
+        if (!(tag = g_hash_table_lookup(bookmarks.tags, *name))) {
+            tag           = g_slice_new(Tag);
+            tag->name     = g_strdup(*name);
+            tag->postings = g_array_new(false, false, sizeof(guint));
+            tag->count    = 0;
+            g_hash_table_insert(bookmarks.tags, tag->name, tag);
+            g_ptr_array_add(bookmarks.dict, tag);
+            bookmarks.sorted = false;
+        }
+        /* ids are added in increasing order, a tag given twice is already
+         * the last posting */
+        if (!tag->postings->len
+            || g_array_index(tag->postings, guint, tag->postings->len - 1) != bm->id
+        ) {
+            g_array_append_val(tag->postings, bm->id);
+            tag->count++;
+        }
+    }
+    g_strfreev(names);
+}
+
+/**
+ * Marks the postings of the removed bookmark as stale. They are dropped on
+ * the next rebuild of the tag index.
+ */
+static void tag_remove(Bookmark *bm)
+{
+    char **names;
+    Tag *tag;
+
+    if (!bm->tags) {
+        return;
+    }
+    names = g_strsplit(bm->tags, " ", -1);
+    for (char **name = names; *name; name++) {
+        /* count each distinct tag of the bookmark once */
+        gboolean seen = false;
+        for (char **prev = names; prev < name && !seen; prev++) {
+            seen = !strcmp(*prev, *name);
+        }
+        if (!seen && (tag = g_hash_table_lookup(bookmarks.tags, *name))) {
+            tag->count--;
+            bookmarks.stale++;
+        }
+    }
+    g_strfreev(names);
+}
+
+static void tag_rebuild(void)
+{
+    g_hash_table_remove_all(bookmarks.tags);
+    g_ptr_array_set_size(bookmarks.dict, 0);
+    bookmarks.stale = 0;
+    /* the items are ordered by increasing ids */
+    for (GList *l = bookmarks.items->head; l; l = l->next) {
+        tag_add(l->data);
+    }
+}
+
+/**
+ * Sets start and end to the range of the sorted tag dictionary that holds
+ * the tags starting with prefix.
+ */
+static void tag_range(const char *prefix, guint *start, guint *end)
+{
+    guint low = 0, high, mid;
+    Tag *tag;
+
+    if (!bookmarks.sorted) {
+        g_ptr_array_sort(bookmarks.dict, tag_cmp);
+        bookmarks.sorted = true;
+    }
+
+    /* find the first tag not lower than prefix */
+    high = bookmarks.dict->len;
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        tag = g_ptr_array_index(bookmarks.dict, mid);
+        if (strcmp(tag->name, prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *start = low;
+    while (low < bookmarks.dict->len
+        && g_str_has_prefix(((Tag*)g_ptr_array_index(bookmarks.dict, low))->name, prefix)
+    ) {
+        low++;
+    }
+    *end = low;
+}
+
+/**
+ * Retrieves the ascending ids of the bookmarks with a tag starting with
+ * prefix. The returned array must be freed.
+ */
+static GArray *tag_lookup(const char *prefix)
+{
+    GArray *ids = g_array_new(false, false, sizeof(guint));
+    guint start, end, i, j;
+    Tag *tag;
+
+    tag_range(prefix, &start, &end);
+    for (i = start; i < end; i++) {
+        tag = g_ptr_array_index(bookmarks.dict, i);
+        g_array_append_vals(ids, tag->postings->data, tag->postings->len);
+    }
+    /* the union of more than one posting list must be sorted and unique */
+    if (end - start > 1) {
+        g_array_sort(ids, id_cmp);
+        for (i = j = 0; i < ids->len; i++) {
+            if (!j || g_array_index(ids, guint, j - 1) != g_array_index(ids, guint, i)) {
+                g_array_index(ids, guint, j++) = g_array_index(ids, guint, i);
+            }
+        }
+        g_array_set_size(ids, j);
+    }
+
+    return ids;
+}
+
+/**
+ * Returns the ids contained in both ascending arrays. Both arrays are
+ * consumed, a is returned as is if it is NULL.
+ */
+static GArray *tag_intersect(GArray *a, GArray *b)
+{
+    guint i = 0, j = 0, n = 0, x, y;
+
+    if (!a) {
+        return b;
+    }
+    while (i < a->len && j < b->len) {
+        x = g_array_index(a, guint, i);
+        y = g_array_index(b, guint, j);
+        if (x < y) {
+            i++;
+        } else if (x > y) {
+            j++;
+        } else {
+            g_array_index(a, guint, n++) = x;
+            i++;
+            j++;
+        }
+    }
+    g_array_set_size(a, n);
+    g_array_free(b, true);
+
+    return a;
+}
+
+static int tag_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp((*(Tag**)a)->name, (*(Tag**)b)->name);
+}
+
+static int id_cmp(gconstpointer a, gconstpointer b)
+{
+    guint x = *(const guint*)a, y = *(const guint*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void free_tag(Tag *tag)
+{
+    g_free(tag->name);
+    g_array_free(tag->postings, true);
+    g_slice_free(Tag, tag);
+}
+
+#ifdef FEATURE_QUEUE
+/**
+ * Replays the lines appended to the queue file since the last call.
+ */
+static void get_queue(void)
+{
+    UtilFileChange change;
+    char *content;
+
+    if (!queue.items) {
+        queue.items = g_queue_new();
+    }
+
+    content = util_file_read_new(vb.files[FILES_QUEUE], &queue.state, &change);
+    if (change == UTIL_FILE_REPLACED) {
+        g_queue_foreach(queue.items, (GFunc)g_free, NULL);
+        g_queue_clear(queue.items);
+        queue.lines = 0;
+    }
+    if (content) {
+        queue_parse(content);
+        g_free(content);
+    }
+}
+
+static void queue_parse(char *content)
+{
+    char *line, *next;
+
+    for (line = content; line && *line; line = next) {
+        if ((next = strchr(line, '\n'))) {
+            *next++ = '\0';
+        }
+        g_strstrip(line);
+        if (!*line) {
+            continue;
+        }
+        queue.lines++;
+
+        if (*line == QUEUE_POP && !line[1]) {
+            g_free(g_queue_pop_head(queue.items));
+        } else if (*line == QUEUE_UNSHIFT) {
+            g_queue_push_head(queue.items, g_strdup(line + 1));
+        } else {
+            g_queue_push_tail(queue.items, g_strdup(line));
+        }
+    }
+}
+
+/**
+ * Replaces the queue file by a file with the URIs still in the queue.
+ */
+static void queue_compact(void)
+{
+    GString *content = g_string_sized_new(queue.state.size);
+
+    for (GList *l = queue.items->head; l; l = l->next) {
+        g_string_append(content, l->data);
+        g_string_append_c(content, '\n');
+    }
+    if (util_file_replace(vb.files[FILES_QUEUE], content->str, content->len, &queue.state)) {
+        queue.lines = queue.items->length;
+    }
+    g_string_free(content, true);
+}
+#endif /* FEATURE_QUEUE */
+
 /**
  * Checks if the given bookmark have all given query strings as prefix.
  *
@@ -268,7 +766,7 @@ static GList *load(const char *file)
  *
  * Return: true if the bookmark contained all tags
  */
-static gboolean bookmark_contains_all_tags(Bookmark *bm, char **query,
+static gboolean bookmark_contains_all_tags(const char *tags, char **query,
     unsigned int qlen)
 {
     unsigned int i;
@@ -278,14 +776,14 @@ static gboolean bookmark_contains_all_tags(Bookmark *bm, char **query,
         return true;
     }
     /* don't use bookmarks without tags if tags are used to filter */
-    if (!bm->tags) {
+    if (!tags) {
         return false;
     }
 
     /* iterate over all query parts */
     for (i = 0; i < qlen; i++) {
         /* put the cursor to the tags string of the bookmarks */
-        char *cursor = bm->tags;
+        const char *cursor = tags;
         found        = false;
 
         /* we want to do a prefix match on all bookmark tags - so we check for
@@ -312,7 +810,12 @@ static gboolean bookmark_contains_all_tags(Bookmark *bm, char **query,
     return true;
 }
 
-static Bookmark *line_to_bookmark(const char *uri, const char *data)
+static gboolean match_tags(const char *first, const char *tags, char **query)
+{
+    return bookmark_contains_all_tags(tags, query, g_strv_length(query));
+}
+
+static Bookmark *line_to_bookmark(const char *uri, char *data)
 {
     char *p;
     Bookmark *bm;
@@ -320,7 +823,7 @@ static Bookmark *line_to_bookmark(const char *uri, const char *data)
     /* data part may consist of title or title<tab>tags*/
     bm      = g_slice_new(Bookmark);
     bm->uri = g_strdup(uri);
-    if ((p = strchr(data, '\t'))) {
+    if (data && (p = strchr(data, '\t'))) {
         *p        = '\0';
         bm->title = g_strdup(data);
         bm->tags  = g_strdup(p + 1);
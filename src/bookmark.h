@@ -20,10 +20,16 @@
 #ifndef _BOOKMARK_H
 #define _BOOKMARK_H
 
+#include "completion.h"
+
 gboolean bookmark_add(const char *uri, const char *title, const char *tags);
 gboolean bookmark_remove(const char *uri);
-gboolean bookmark_fill_completion(GtkListStore *store, const char *input);
-gboolean bookmark_fill_tag_completion(GtkListStore *store, const char *input);
+void bookmark_cleanup(void);
+void bookmark_query_completion(CompletionQuery *query, const char *input,
+    gpointer data);
+gboolean bookmark_narrow_completion(GtkListStore *store, const char *input);
+void bookmark_query_tag_completion(CompletionQuery *query, const char *input,
+    gpointer data);
 #ifdef FEATURE_QUEUE
 gboolean bookmark_queue_push(const char *uri);
 gboolean bookmark_queue_unshift(const char *uri);
@@ -23,6 +23,29 @@
 
 extern VbCore vb;
 
+/* number of items a query collects before they are put into the store */
+#define QUERY_BATCH_SIZE 100
+
+/* Completion items that are searched in a worker thread and put into the
+ * store in the main thread in batches. */
+struct _CompletionQuery {
+    volatile gint          refcount;
+    GCancellable           *cancellable;
+    GtkListStore           *store;
+    char                   *input;
+    CompletionProviderFunc func;
+    gpointer               func_data;
+    CompletionResultFunc   result;
+    gpointer               result_data;
+    GPtrArray              *batch;    /* items collected in the worker */
+    CompletionSinkFunc     sink;      /* gets the items instead of the store */
+    gpointer               sink_data;
+    GMutex                 lock;      /* guards the fields below */
+    GQueue                 pending;   /* batches to put into the store */
+    gboolean               finished;
+    guint                  idle_id;
+};
+
 static struct {
     GtkWidget *win;
     GtkWidget *tree;
@@ -32,6 +55,11 @@ static struct {
 
 static gboolean tree_selection_func(GtkTreeSelection *selection,
     GtkTreeModel *model, GtkTreePath *path, gboolean selected, gpointer data);
+static void query_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable);
+static void query_flush(CompletionQuery *query, gboolean finished);
+static gboolean query_apply(gpointer data);
+static CompletionQuery *query_ref(CompletionQuery *query);
 
 
 gboolean completion_create(GtkTreeModel *model, CompletionSelectFunc selfunc,
@@ -195,6 +223,161 @@ void completion_clean(void)
     }
 }
 
+/**
+ * Removes all items from the store that are not matched by given function.
+ *
+ * @store: Store of a previous completion.
+ * @func:  Function called with the first and the data column of each item.
+ * @query: Data given to the match function.
+ */
+void completion_narrow(GtkListStore *store, CompletionMatchFunc func,
+    gpointer query)
+{
+    GtkTreeModel *model = GTK_TREE_MODEL(store);
+    GtkTreeIter iter;
+    gboolean valid;
+    char *first, *data;
+
+    valid = gtk_tree_model_get_iter_first(model, &iter);
+    while (valid) {
+        gtk_tree_model_get(
+            model, &iter,
+            COMPLETION_STORE_FIRST, &first,
+            COMPLETION_STORE_DATA, &data,
+            -1
+        );
+        if (func(first, data, query)) {
+            valid = gtk_tree_model_iter_next(model, &iter);
+        } else {
+            valid = gtk_list_store_remove(store, &iter);
+        }
+        g_free(first);
+        g_free(data);
+    }
+}
+
+/**
+ * Starts a worker thread that runs the provider function to collect the
+ * completion items matching input. The found items are put into the store
+ * in batches in the main thread, after each batch the result function is
+ * called.
+ *
+ * Returned query must be released by completion_query_cancel() or
+ * completion_query_unref().
+ */
+CompletionQuery *completion_query_start(GtkListStore *store, const char *input,
+    CompletionProviderFunc func, gpointer func_data,
+    CompletionResultFunc result, gpointer result_data)
+{
+    CompletionQuery *query;
+    GTask *task;
+
+    query              = g_slice_new0(CompletionQuery);
+    query->refcount    = 1;
+    query->cancellable = g_cancellable_new();
+    query->store       = g_object_ref(store);
+    query->input       = g_strdup(input);
+    query->func        = func;
+    query->func_data   = func_data;
+    query->result      = result;
+    query->result_data = result_data;
+    g_mutex_init(&query->lock);
+    g_queue_init(&query->pending);
+
+    task = g_task_new(NULL, query->cancellable, NULL, NULL);
+    g_task_set_task_data(task, query_ref(query), (GDestroyNotify)completion_query_unref);
+    g_task_run_in_thread(task, query_thread);
+    g_object_unref(task);
+
+    return query;
+}
+
+/**
+ * Runs the provider func in the calling thread and passes the found items to
+ * the sink function instead of putting them into a store. The query is
+ * cancelled if the sink returns false.
+ */
+void completion_query_run(const char *input, CompletionProviderFunc func,
+    gpointer func_data, CompletionSinkFunc sink, gpointer sink_data)
+{
+    CompletionQuery *query;
+
+    query              = g_slice_new0(CompletionQuery);
+    query->refcount    = 1;
+    query->cancellable = g_cancellable_new();
+    query->input       = g_strdup(input);
+    query->sink        = sink;
+    query->sink_data   = sink_data;
+    g_mutex_init(&query->lock);
+    g_queue_init(&query->pending);
+
+    func(query, query->input, func_data);
+
+    completion_query_unref(query);
+}
+
+/**
+ * Adds an item to the query. This must be called from the provider function
+ * only.
+ */
+void completion_query_add(CompletionQuery *query, const char *first,
+    const char *second, const char *data)
+{
+    if (query->sink) {
+        if (!query->sink(first, second, data, query->sink_data)) {
+            g_cancellable_cancel(query->cancellable);
+        }
+        return;
+    }
+    if (!query->batch) {
+        query->batch = g_ptr_array_new_with_free_func(g_free);
+    }
+    g_ptr_array_add(query->batch, g_strdup(first));
+    g_ptr_array_add(query->batch, g_strdup(second));
+    g_ptr_array_add(query->batch, g_strdup(data));
+
+    if (query->batch->len >= QUERY_BATCH_SIZE * 3) {
+        query_flush(query, false);
+    }
+}
+
+/**
+ * Checks if the query was cancelled, so that the provider function can stop
+ * the search.
+ */
+gboolean completion_query_cancelled(CompletionQuery *query)
+{
+    return g_cancellable_is_cancelled(query->cancellable);
+}
+
+/**
+ * Stops putting items of the query into the store and releases the query.
+ */
+void completion_query_cancel(CompletionQuery *query)
+{
+    g_cancellable_cancel(query->cancellable);
+    completion_query_unref(query);
+}
+
+void completion_query_unref(CompletionQuery *query)
+{
+    if (!g_atomic_int_dec_and_test(&query->refcount)) {
+        return;
+    }
+    g_object_unref(query->cancellable);
+    if (query->store) {
+        g_object_unref(query->store);
+    }
+    g_free(query->input);
+    if (query->batch) {
+        g_ptr_array_free(query->batch, true);
+    }
+    g_queue_foreach(&query->pending, (GFunc)g_ptr_array_unref, NULL);
+    g_queue_clear(&query->pending);
+    g_mutex_clear(&query->lock);
+    g_slice_free(CompletionQuery, query);
+}
+
 static gboolean tree_selection_func(GtkTreeSelection *selection,
     GtkTreeModel *model, GtkTreePath *path, gboolean selected, gpointer data)
 {
@@ -213,3 +396,82 @@ static gboolean tree_selection_func(GtkTreeSelection *selection,
 
     return true;
 }
+
+static void query_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable)
+{
+    CompletionQuery *query = data;
+
+    query->func(query, query->input, query->func_data);
+    query_flush(query, true);
+
+    g_task_return_boolean(task, true);
+}
+
+/**
+ * Hands the collected items over to the main thread.
+ */
+static void query_flush(CompletionQuery *query, gboolean finished)
+{
+    g_mutex_lock(&query->lock);
+    if (query->batch) {
+        g_queue_push_tail(&query->pending, query->batch);
+        query->batch = NULL;
+    }
+    query->finished = finished;
+    if (!query->idle_id) {
+        query->idle_id = g_idle_add(query_apply, query_ref(query));
+    }
+    g_mutex_unlock(&query->lock);
+}
+
+/**
+ * Puts the pending items of a query into the store. This runs in the main
+ * thread.
+ */
+static gboolean query_apply(gpointer data)
+{
+    CompletionQuery *query = data;
+    GQueue pending;
+    GPtrArray *batch;
+    GtkTreeIter iter;
+    gboolean finished, cancelled;
+
+    g_mutex_lock(&query->lock);
+    pending = query->pending;
+    g_queue_init(&query->pending);
+    finished       = query->finished;
+    query->idle_id = 0;
+    g_mutex_unlock(&query->lock);
+
+    cancelled = g_cancellable_is_cancelled(query->cancellable);
+    while ((batch = g_queue_pop_head(&pending))) {
+        for (guint i = 0; !cancelled && i < batch->len; i += 3) {
+            gtk_list_store_append(query->store, &iter);
+            gtk_list_store_set(
+                query->store, &iter,
+                COMPLETION_STORE_FIRST, batch->pdata[i],
+#ifdef FEATURE_TITLE_IN_COMPLETION
+                COMPLETION_STORE_SECOND, batch->pdata[i + 1],
+#endif
+                COMPLETION_STORE_DATA, batch->pdata[i + 2],
+                -1
+            );
+        }
+        g_ptr_array_unref(batch);
+    }
+
+    if (!cancelled) {
+        query->result(query, query->store, finished, query->result_data);
+    }
+    completion_query_unref(query);
+
+    return false;
+}
+
+static CompletionQuery *query_ref(CompletionQuery *query)
+{
+    g_atomic_int_inc(&query->refcount);
+
+    return query;
+}
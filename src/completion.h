@@ -27,14 +27,42 @@ enum {
 #ifdef FEATURE_TITLE_IN_COMPLETION
     COMPLETION_STORE_SECOND,
 #endif
+    COMPLETION_STORE_DATA,  /* hidden data used to narrow the completion */
     COMPLETION_STORE_NUM
 };
 
+typedef struct _CompletionQuery CompletionQuery;
+
 typedef void (*CompletionSelectFunc) (char *match);
+typedef gboolean (*CompletionFillFunc) (GtkListStore *store, const char *input);
+typedef gboolean (*CompletionNarrowFunc) (GtkListStore *store, const char *input);
+typedef gboolean (*CompletionMatchFunc) (const char *first, const char *data,
+    gpointer query);
+/* called in a worker thread to add the items matching input to the query */
+typedef void (*CompletionProviderFunc) (CompletionQuery *query,
+    const char *input, gpointer data);
+/* called in main thread after new items where put into the store */
+typedef void (*CompletionResultFunc) (CompletionQuery *query,
+    GtkListStore *store, gboolean finished, gpointer data);
+/* gets the items of a query run without store, returns false to cancel */
+typedef gboolean (*CompletionSinkFunc) (const char *first, const char *second,
+    const char *data, gpointer sink_data);
 
 gboolean completion_create(GtkTreeModel *model, CompletionSelectFunc selfunc,
     gboolean back);
 void completion_clean(void);
 void completion_next(gboolean back);
+void completion_narrow(GtkListStore *store, CompletionMatchFunc func,
+    gpointer query);
+CompletionQuery *completion_query_start(GtkListStore *store, const char *input,
+    CompletionProviderFunc func, gpointer func_data,
+    CompletionResultFunc result, gpointer result_data);
+void completion_query_run(const char *input, CompletionProviderFunc func,
+    gpointer func_data, CompletionSinkFunc sink, gpointer sink_data);
+void completion_query_add(CompletionQuery *query, const char *first,
+    const char *second, const char *data);
+gboolean completion_query_cancelled(CompletionQuery *query);
+void completion_query_cancel(CompletionQuery *query);
+void completion_query_unref(CompletionQuery *query);
 
 #endif /* end of include guard: _COMPLETION_H */
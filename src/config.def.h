@@ -54,6 +54,9 @@
 #define FEATURE_ARH
 /* allow to use socket to remote control vimb */
 #define FEATURE_SOCKET
+/* let the first instance answer the history and bookmark completion of the
+ * instances started later, so that only one of them loads the files */
+/* #define FEATURE_SHARED_STORE */
 
 /* time in seconds after that message will be removed from inputbox if the
  * message where only temporary */
@@ -74,6 +77,11 @@
 
 #define MAXIMUM_HINTS              500
 
+/* maximum number of history items shown in the url completion */
+#define HISTORY_COMPLETION_MAX     500
+/* days after that the weight of visits for the url completion is halved */
+#define HISTORY_FRECENCY_HALFLIFE   14
+
 #define WIN_WIDTH                  800
 #define WIN_HEIGHT                 600
 
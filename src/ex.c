@@ -99,6 +99,24 @@ typedef struct {
 
 typedef VbCmdResult (*ExFunc)(const ExArg *arg);
 
+/* A command of a compiled ExCmd. The lhs and rhs are copied into the
+ * strings of the ExArg when the command is run. The rhs of commands with
+ * EX_FLAG_EXP points to the unparsed input, because the expansions depend on
+ * the state when the command is run. */
+typedef struct {
+    ExArg      arg;     /* without lhs and rhs */
+    char       *lhs;
+    const char *rhs;
+    gsize      len;
+} ExParsed;
+
+struct _ExCmd {
+    char       *input;
+    ExParsed   *cmds;
+    guint      len;
+    const char *rest;   /* first command that could not be parsed */
+};
+
 typedef struct {
     const char *name;         /* full name of the command even if called abbreviated */
     ExCode    code;           /* constant id for the command */
@@ -119,8 +137,11 @@ static struct {
 
 static void input_activate(void);
 static gboolean parse(const char **input, ExArg *arg, gboolean *nohist);
+static gboolean parse_command(const char **input, ExArg *arg,
+    gboolean *nohist, gboolean report);
 static gboolean parse_count(const char **input, ExArg *arg);
-static gboolean parse_command_name(const char **input, ExArg *arg);
+static gboolean parse_command_name(const char **input, ExArg *arg,
+    gboolean report);
 static gboolean parse_bang(const char **input, ExArg *arg);
 static gboolean parse_lhs(const char **input, ExArg *arg);
 static gboolean parse_rhs(const char **input, ExArg *arg);
@@ -151,6 +172,15 @@ static VbCmdResult ex_shortcut(const ExArg *arg);
 static VbCmdResult ex_handlers(const ExArg *arg);
 
 static gboolean complete(short direction);
+static gboolean fill_completion(GtkListStore **store, const char *input,
+    const char *query, CompletionFillFunc fill, CompletionNarrowFunc narrow);
+static void query_completion(const char *input, const char *query,
+    const char *prefix, CompletionProviderFunc provider, gpointer data,
+    CompletionNarrowFunc narrow, gboolean sort, gboolean back);
+static void query_completion_result(CompletionQuery *query, GtkListStore *store,
+    gboolean finished, gpointer data);
+static void completion_cancel_query(void);
+static void completion_forget(void);
 static void completion_select(char *match);
 static gboolean history(gboolean prev);
 static void history_rewind(void);
@@ -205,6 +235,16 @@ static struct {
     guint count;
     char  *prefix;  /* completion prefix like :, ? and / */
     char  *current; /* holds the current written input box content */
+    /* Candidates of the last completion that are narrowed if the query is
+     * extended by further typing. */
+    GtkListStore         *store;
+    char                 *key;    /* input before the completed query */
+    char                 *query;  /* the query the store was filled for */
+    CompletionNarrowFunc narrow;
+    /* Completion that is searched in a worker thread. */
+    CompletionQuery      *pending;
+    gboolean             back;    /* select the last item first */
+    char                 *found_prefix; /* prefix to set if items are found */
 } excomp;
 
 static struct {
@@ -231,6 +271,7 @@ void ex_enter(void)
 void ex_leave(void)
 {
     completion_clean();
+    completion_forget();
     hints_clear();
 }
 
@@ -266,6 +307,11 @@ VbResult ex_keypress(int key)
 
         res = RESULT_COMPLETE;
     } else {
+        /* the running completion does not match the changed input anymore */
+        if (key != KEY_TAB && key != KEY_SHIFT_TAB) {
+            completion_cancel_query();
+        }
+
         res = RESULT_COMPLETE;
         switch (key) {
             case KEY_TAB:
@@ -498,10 +544,140 @@ VbCmdResult ex_run_string(const char *input, gboolean enable_history)
     return res;
 }
 
+/**
+ * Parses the given string of ex commands once, so that it can be run many
+ * times by ex_cmd_run() without to parse it again.
+ *
+ * Returned ExCmd must be freed by ex_cmd_free().
+ */
+ExCmd *ex_cmd_compile(const char *input)
+{
+    ExCmd *cmd   = g_slice_new0(ExCmd);
+    GArray *list = g_array_new(false, false, sizeof(ExParsed));
+    ExArg arg    = {0};
+    ExParsed parsed;
+    const char *in, *start;
+    gboolean nohist;
+
+    cmd->input = g_strdup(input);
+    arg.lhs    = g_string_new("");
+    arg.rhs    = g_string_new("");
+    for (in = cmd->input; *in; ) {
+        start = in;
+        if (!parse_command(&in, &arg, &nohist, false)) {
+            /* keep the rest to report the error when the command is run */
+            cmd->rest = start;
+            break;
+        }
+        start = in;
+        parse_rhs(&in, &arg);
+
+        /* the ExArg is copied to keep the state like ex_run_string() does
+         * from one command to the next */
+        parsed.arg     = arg;
+        parsed.arg.lhs = NULL;
+        parsed.arg.rhs = NULL;
+        parsed.lhs     = g_strndup(arg.lhs->str, arg.lhs->len);
+        if (arg.flags & EX_FLAG_EXP) {
+            parsed.rhs = start;
+            parsed.len = 0;
+        } else {
+            parsed.rhs = g_strndup(arg.rhs->str, arg.rhs->len);
+            parsed.len = arg.rhs->len;
+        }
+        g_array_append_val(list, parsed);
+
+        if (*in) {
+            in++;
+        }
+    }
+    g_string_free(arg.lhs, true);
+    g_string_free(arg.rhs, true);
+
+    cmd->len  = list->len;
+    cmd->cmds = (ExParsed*)g_array_free(list, false);
+
+    return cmd;
+}
+
+/**
+ * Runs the commands of a ExCmd like ex_run_string() without to write them to
+ * the history.
+ */
+VbCmdResult ex_cmd_run(const ExCmd *cmd)
+{
+    VbCmdResult res = VB_CMD_ERROR | VB_CMD_KEEPINPUT;
+    const char *in;
+    ExParsed *parsed;
+    ExArg arg;
+    /* the commands may change their lhs and rhs, so each run gets own
+     * copies of the compiled strings */
+    GString *lhs = g_string_sized_new(32), *rhs = g_string_sized_new(64);
+
+    for (guint i = 0; i < cmd->len; i++) {
+        parsed  = &cmd->cmds[i];
+        arg     = parsed->arg;
+        arg.lhs = g_string_assign(lhs, parsed->lhs);
+        arg.rhs = g_string_truncate(rhs, 0);
+        if (arg.flags & EX_FLAG_EXP) {
+            in = parsed->rhs;
+            parse_rhs(&in, &arg);
+        } else {
+            g_string_append_len(rhs, parsed->rhs, parsed->len);
+        }
+        if (!(res = execute(&arg))) {
+            break;
+        }
+    }
+    g_string_free(lhs, true);
+    g_string_free(rhs, true);
+
+    if (res && cmd->rest) {
+        /* let the parser report the error, the result is that of the last
+         * command like for ex_run_string() */
+        ex_run_string(cmd->rest, false);
+    }
+
+    return res;
+}
+
+void ex_cmd_free(ExCmd *cmd)
+{
+    for (guint i = 0; i < cmd->len; i++) {
+        g_free(cmd->cmds[i].lhs);
+        if (!(cmd->cmds[i].arg.flags & EX_FLAG_EXP)) {
+            g_free((char*)cmd->cmds[i].rhs);
+        }
+    }
+    g_free(cmd->cmds);
+    g_free(cmd->input);
+    g_slice_free(ExCmd, cmd);
+}
+
 /**
  * Parses given input string into given ExArg pointer.
  */
 static gboolean parse(const char **input, ExArg *arg, gboolean *nohist)
+{
+    if (!parse_command(input, arg, nohist, true)) {
+        return false;
+    }
+    /* parse the rhs if this is available */
+    parse_rhs(input, arg);
+
+    if (**input) {
+        (*input)++;
+    }
+
+    return true;
+}
+
+/**
+ * Parses the next command of the input up to its right hand side. If report
+ * is set, unknown commands are shown as error.
+ */
+static gboolean parse_command(const char **input, ExArg *arg,
+    gboolean *nohist, gboolean report)
 {
     if (!*input || !**input) {
         return false;
@@ -521,7 +697,7 @@ static gboolean parse(const char **input, ExArg *arg, gboolean *nohist)
     parse_count(input, arg);
 
     skip_whitespace(input);
-    if (!parse_command_name(input, arg)) {
+    if (!parse_command_name(input, arg, report)) {
         return false;
     }
 
@@ -535,13 +711,7 @@ static gboolean parse(const char **input, ExArg *arg, gboolean *nohist)
     if (arg->flags & EX_FLAG_LHS) {
         parse_lhs(input, arg);
     }
-    /* parse the rhs if this is available */
     skip_whitespace(input);
-    parse_rhs(input, arg);
-
-    if (**input) {
-        (*input)++;
-    }
 
     return true;
 }
@@ -565,7 +735,8 @@ static gboolean parse_count(const char **input, ExArg *arg)
 /**
  * Parse the command name from given input.
  */
-static gboolean parse_command_name(const char **input, ExArg *arg)
+static gboolean parse_command_name(const char **input, ExArg *arg,
+    gboolean report)
 {
     int len      = 0;
     int first    = 0;   /* number of first found command */
@@ -595,6 +766,9 @@ static gboolean parse_command_name(const char **input, ExArg *arg)
     } while (matches > 0 && **input && !VB_IS_SPACE(**input) && **input != '!');
 
     if (!matches) {
+        if (!report) {
+            return false;
+        }
         /* read until next whitespace or end of input to get command name for
          * error message - vim uses the whole rest of the input string - but
          * the first word seems to bee enough for the error message */
@@ -1049,7 +1223,7 @@ static gboolean complete(short direction)
     const char *in;         /* pointer to input that we move */
     gboolean found = false;
     gboolean sort  = false;
-    GtkListStore *store;
+    GtkListStore *store = NULL;
 
     /* if direction is 0 stop the completion */
     if (!direction) {
@@ -1074,7 +1248,17 @@ static gboolean complete(short direction)
         completion_clean();
     }
 
-    store = gtk_list_store_new(COMPLETION_STORE_NUM, G_TYPE_STRING, G_TYPE_STRING);
+    if (excomp.pending) {
+        /* wait for the running completion of the same input */
+        if (g_str_has_prefix(input, excomp.key)
+            && !strcmp(input + strlen(excomp.key), excomp.query)
+        ) {
+            g_free(input);
+
+            return true;
+        }
+        completion_cancel_query();
+    }
 
     in = (const char*)input;
     if (*in == ':') {
@@ -1093,7 +1277,7 @@ static gboolean complete(short direction)
 
         /* Do ex command specific completion if the comman is recognized and
          * there is a space after the command and the optional '!' bang. */
-        if (parse_command_name(&in, arg) && parse_bang(&in, arg) && VB_IS_SPACE(*in)) {
+        if (parse_command_name(&in, arg, true) && parse_bang(&in, arg) && VB_IS_SPACE(*in)) {
             const char *token;
 
             /* Get only the last word of input string for the completion for
@@ -1122,41 +1306,65 @@ static gboolean complete(short direction)
                 case EX_OPEN:
                 case EX_TABOPEN:
                     if (*token == '!') {
-                        found = bookmark_fill_completion(store, token + 1);
+                        query_completion(
+                            input, token + 1, NULL, bookmark_query_completion,
+                            NULL, bookmark_narrow_completion, false, direction < 0
+                        );
                     } else {
-                        found = history_fill_completion(store, HISTORY_URL, token);
+                        query_completion(
+                            input, token, NULL, history_query_completion,
+                            GINT_TO_POINTER(HISTORY_URL),
+                            history_narrow_completion, false, direction < 0
+                        );
                     }
                     break;
 
                 case EX_SET:
                     sort  = true;
-                    found = setting_fill_completion(store, token);
+                    found = fill_completion(
+                        &store, input, token,
+                        setting_fill_completion, util_narrow_completion
+                    );
                     break;
 
                 case EX_BMA:
-                    sort  = true;
-                    found = bookmark_fill_tag_completion(store, token);
+                    query_completion(
+                        input, token, NULL, bookmark_query_tag_completion, NULL,
+                        util_narrow_completion, true, direction < 0
+                    );
                     break;
 
                 case EX_SCR:
                     sort  = true;
-                    found = shortcut_fill_completion(store, token);
+                    found = fill_completion(
+                        &store, input, token,
+                        shortcut_fill_completion, util_narrow_completion
+                    );
                     break;
 
                 case EX_HANDREM:
                     sort  = true;
-                    found = handler_fill_completion(store, token);
+                    found = fill_completion(
+                        &store, input, token,
+                        handler_fill_completion, util_narrow_completion
+                    );
                     break;
 
 #ifdef FEATURE_AUTOCMD
                 case EX_AUTOCMD:
                     sort  = true;
-                    found = autocmd_fill_event_completion(store, token);
+                    found = fill_completion(
+                        &store, input, token,
+                        autocmd_fill_event_completion, util_narrow_completion
+                    );
                     break;
 
                 case EX_AUGROUP:
                     sort  = true;
-                    found = autocmd_fill_group_completion(store, token);
+                    found = fill_completion(
+                        &store, input, token,
+                        autocmd_fill_group_completion, util_narrow_completion
+                    );
                     break;
 #endif
 
@@ -1171,18 +1379,21 @@ static gboolean complete(short direction)
              * completion_select function. */
             excomp.count = arg->count;
 
-            if (ex_fill_completion(store, in)) {
+            if (fill_completion(&store, input, in, ex_fill_completion, util_narrow_completion)) {
                 OVERWRITE_STRING(excomp.prefix, ":");
                 found = true;
             }
         }
         free_cmdarg(arg);
     } else if (*in == '/' || *in == '?') {
-        if (history_fill_completion(store, HISTORY_SEARCH, in + 1)) {
-            OVERWRITE_NSTRING(excomp.prefix, in, 1);
-            sort  = true;
-            found = true;
-        }
+        char prefix[2] = {*in, '\0'};
+
+        /* the prefix is only changed if there are search items found */
+        query_completion(
+            input, in + 1, prefix, history_query_completion,
+            GINT_TO_POINTER(HISTORY_SEARCH), util_narrow_completion, true,
+            direction < 0
+        );
     }
 
     /* if the input could be parsed and the tree view could be filled */
@@ -1194,12 +1405,173 @@ static gboolean complete(short direction)
 
     if (found) {
         completion_create(GTK_TREE_MODEL(store), completion_select, direction < 0);
+    } else if (store) {
+        g_object_unref(store);
     }
 
     g_free(input);
     return true;
 }
 
+/**
+ * Fills a new store with the completion items matching the query. If the
+ * same source was completed before with a query that is only extended by the
+ * current one, the items of the previous completion are narrowed instead.
+ *
+ * @store:  Pointer that is set to the filled store, the caller gets the
+ *          ownership of the store.
+ * @input:  The whole input of the inputbox.
+ * @query:  Pointer into input to the part to complete.
+ * @fill:   Function to fill a new store with the items matching query.
+ * @narrow: Function to remove the items from the previous store that do not
+ *          match the query.
+ *
+ * Returns true if there are items found for the query.
+ */
+static gboolean fill_completion(GtkListStore **store, const char *input,
+    const char *query, CompletionFillFunc fill, CompletionNarrowFunc narrow)
+{
+    gboolean found;
+    int keylen = query - input;
+
+    if (excomp.store && excomp.narrow == narrow
+        && strlen(excomp.key) == keylen && !strncmp(excomp.key, input, keylen)
+        && g_str_has_prefix(query, excomp.query)
+        && narrow(excomp.store, query)
+    ) {
+        *store = g_object_ref(excomp.store);
+        found  = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(*store), NULL) > 0;
+    } else {
+        completion_forget();
+
+        *store = gtk_list_store_new(
+            COMPLETION_STORE_NUM, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING
+        );
+        found = fill(*store, query);
+
+        excomp.store  = g_object_ref(*store);
+        excomp.key    = g_strndup(input, keylen);
+        excomp.narrow = narrow;
+    }
+    OVERWRITE_STRING(excomp.query, query);
+
+    return found;
+}
+
+/**
+ * Like fill_completion() but the store is filled by the provider in a worker
+ * thread, so that large sources do not block the input. The completion is
+ * shown as soon as the first items are found.
+ *
+ * @input:    The whole input of the inputbox.
+ * @query:    Pointer into input to the part to complete.
+ * @prefix:   Completion prefix to set if items are found or NULL to keep the
+ *            current one.
+ * @provider: Function called in the worker thread to collect the items.
+ * @data:     Data given to the provider.
+ * @narrow:   Function to remove the items from the previous store that do
+ *            not match the query.
+ * @sort:     Whether the items are sorted by their value.
+ * @back:     Whether the last item should be selected first.
+ */
+static void query_completion(const char *input, const char *query,
+    const char *prefix, CompletionProviderFunc provider, gpointer data,
+    CompletionNarrowFunc narrow, gboolean sort, gboolean back)
+{
+    GtkListStore *store;
+    int keylen = query - input;
+
+    if (excomp.store && excomp.narrow == narrow
+        && strlen(excomp.key) == keylen && !strncmp(excomp.key, input, keylen)
+        && g_str_has_prefix(query, excomp.query)
+        && narrow(excomp.store, query)
+    ) {
+        OVERWRITE_STRING(excomp.query, query);
+        if (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(excomp.store), NULL)) {
+            if (prefix) {
+                OVERWRITE_STRING(excomp.prefix, prefix);
+            }
+            completion_create(
+                GTK_TREE_MODEL(g_object_ref(excomp.store)), completion_select, back
+            );
+        }
+        return;
+    }
+
+    completion_forget();
+
+    store = gtk_list_store_new(
+        COMPLETION_STORE_NUM, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING
+    );
+    if (sort) {
+        gtk_tree_sortable_set_sort_column_id(
+            GTK_TREE_SORTABLE(store), COMPLETION_STORE_FIRST, GTK_SORT_ASCENDING
+        );
+    }
+    excomp.key     = g_strndup(input, keylen);
+    excomp.query   = g_strdup(query);
+    excomp.narrow  = narrow;
+    excomp.back    = back;
+    excomp.found_prefix = g_strdup(prefix);
+    excomp.pending = completion_query_start(
+        store, query, provider, data, query_completion_result, NULL
+    );
+    g_object_unref(store);
+}
+
+/**
+ * Called each time new items of the running completion query are put into
+ * the store.
+ */
+static void query_completion_result(CompletionQuery *query, GtkListStore *store,
+    gboolean finished, gpointer data)
+{
+    int rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(store), NULL);
+
+    if (finished) {
+        /* keep the complete store to narrow it on further typing */
+        excomp.store = g_object_ref(store);
+        completion_query_unref(excomp.pending);
+        excomp.pending = NULL;
+    }
+
+    /* Show the completion with the first items found, but wait for the end
+     * if there is only one item that would be selected directly. */
+    if (!(vb.mode->flags & FLAG_COMPLETION) && (rows > 1 || (finished && rows))) {
+        if (excomp.found_prefix) {
+            OVERWRITE_STRING(excomp.prefix, excomp.found_prefix);
+        }
+        completion_create(GTK_TREE_MODEL(g_object_ref(store)), completion_select, excomp.back);
+    }
+}
+
+/**
+ * Stops the running completion query.
+ */
+static void completion_cancel_query(void)
+{
+    if (excomp.pending) {
+        completion_query_cancel(excomp.pending);
+        excomp.pending = NULL;
+    }
+}
+
+/**
+ * Drops the candidates of the last completion.
+ */
+static void completion_forget(void)
+{
+    completion_cancel_query();
+    if (excomp.store) {
+        g_object_unref(excomp.store);
+        excomp.store = NULL;
+    }
+    OVERWRITE_STRING(excomp.key, NULL);
+    OVERWRITE_STRING(excomp.query, NULL);
+    OVERWRITE_STRING(excomp.found_prefix, NULL);
+    excomp.narrow = NULL;
+}
+
 /**
  * Callback called from the completion if a item is selected to write the
  * matched item according with previously saved prefix and command name to the
@@ -23,11 +23,17 @@
 #include "config.h"
 #include "main.h"
 
+/* Ex commands that are parsed once to be run many times. */
+typedef struct _ExCmd ExCmd;
+
 void ex_enter(void);
 void ex_leave(void);
 VbResult ex_keypress(int key);
 void ex_input_changed(const char *text);
 gboolean ex_fill_completion(GtkListStore *store, const char *input);
 VbCmdResult ex_run_string(const char *input, gboolean enable_history);
+ExCmd *ex_cmd_compile(const char *input);
+VbCmdResult ex_cmd_run(const ExCmd *cmd);
+void ex_cmd_free(ExCmd *cmd);
 
 #endif /* end of include guard: _EX_H */
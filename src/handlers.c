@@ -35,6 +35,7 @@ void handlers_cleanup(void)
 {
     if (handlers) {
         g_hash_table_destroy(handlers);
+        handlers = NULL;
     }
 }
 
@@ -82,15 +83,20 @@ gboolean handler_fill_completion(GtkListStore *store, const char *input)
     return found;
 }
 
+/**
+ * Get the handler for the scheme of the uri. The scheme is copied to the
+ * stack, so that the lookup does not allocate memory.
+ */
 static char *handler_lookup(const char *uri)
 {
-    char *p, *schema, *handler = NULL;
+    char *p, *schema;
 
-    if ((p = strchr(uri, ':'))) {
-        schema  = g_strndup(uri, p - uri);
-        handler = g_hash_table_lookup(handlers, schema);
-        g_free(schema);
+    if (!(p = strchr(uri, ':'))) {
+        return NULL;
     }
+    schema = g_newa(char, p - uri + 1);
+    memcpy(schema, uri, p - uri);
+    schema[p - uri] = '\0';
 
-    return handler;
+    return g_hash_table_lookup(handlers, schema);
 }
@@ -18,11 +18,21 @@
  */
 
 #include "config.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "main.h"
 #include "history.h"
 #include "util.h"
 #include "completion.h"
 #include "ascii.h"
+#ifdef FEATURE_SHARED_STORE
+#include "store.h"
+#endif
 
 extern VbCore vb;
 
@@ -34,128 +44,403 @@ static const VbFile file_map[HISTORY_LAST] = {
     FILES_HISTORY
 };
 
+/* minimum number of stale trigram postings before these are removed */
+#define TRIGRAM_STALE_MIN 1024
+/* packs the lower case chars of the trigram at s into an integer */
+#define TRIGRAM(s) ((guint)(guchar)g_ascii_tolower((s)[0]) << 16 \
+    | (guint)(guchar)g_ascii_tolower((s)[1]) << 8 \
+    | (guint)(guchar)g_ascii_tolower((s)[2]))
+
+/* number of buffered bytes that are written to the shard at once */
+#define JOURNAL_FLUSH_SIZE 4096
+/* milliseconds to wait before writing the buffered entries again if the
+ * history file is compacted */
+#define JOURNAL_RETRY_DELAY 100
+/* the history file is compacted if it and the shards that can be folded into
+ * it have that many times more lines than unique items but not before they
+ * have COMPACT_MIN_LINES lines */
+#define COMPACT_RATIO 2
+#define COMPACT_MIN_LINES 1000
+/* number of shards of quit instances that are folded in any case */
+#define COMPACT_MAX_SHARDS 8
+
+/* start of the time scale of the frecency rank */
+#define FRECENCY_EPOCH 1420070400
+
 typedef struct {
-    char *first;
-    char *second;
+    char   *first;
+    char   *second;
+    GList  *link;       /* position of the item in the index queue */
+    guint  id;          /* trigram posting id, increases with each update */
+    guint  visits;      /* number of visits of the URI */
+    gint64 lastvisit;   /* unix time of the last visit */
+    double rank;        /* frecency of the URI */
 } History;
 
-static GList *load(const char *file);
-static void write_to_file(GList *list, const char *file);
-static gboolean history_item_contains_all_tags(History *item, char **query,
-    unsigned int qlen);
+/* Each instance appends its history entries to an own shard file in the
+ * directory named like the history file with ".d" suffix. The shards are
+ * named by the process id and a random token of their instance, which holds
+ * a shared lock on its shard as long as it runs. The lines are prefixed with
+ * the time they were added, so that the lines of all shards can be merged in
+ * the order they were added. The shards of instances that are gone are
+ * folded into the history file by the compaction. */
+typedef struct {
+    char          *file;
+    gboolean      own;      /* the shard of this instance */
+    gboolean      gone;     /* the instance of the shard has quit */
+    UtilFileState state;    /* part of the shard already in the index */
+    guint         lines;
+    gboolean      seen;     /* found by the last directory scan */
+} HistoryShard;
+
+/* A shard line read from file together with its time. */
+typedef struct {
+    gint64 time;
+    guint  pos;             /* keeps the order of lines with the same time */
+    char   *line;
+} ShardLine;
+
+/* Resident index of the unique items of a history file. */
+typedef struct {
+    GQueue        *items;   /* History items, the oldest first */
+    GHashTable    *lookup;  /* maps History.first to the item */
+    UtilFileState state;    /* part of the file already in the index */
+    /* Trigram index used for the tag matching of the URL history. */
+    GHashTable    *trigrams; /* maps packed lower case trigram to sorted
+                                GArray of History.id */
+    GHashTable    *ids;      /* maps History.id to the item */
+    guint         nextid;
+    guint         stale;     /* number of ids no more in use */
+    gboolean      ranked;    /* items have visits and are ranked by frecency */
+    GString       *journal;   /* added lines not yet written to the shard */
+    guint         lines;      /* lines in the file, including duplicates */
+    char          *sharddir;  /* directory of the shards */
+    char          *shard;     /* file of the own shard */
+    int           shardfd;    /* the own shard if it is created */
+    GHashTable    *shards;    /* maps the file name to the HistoryShard */
+    gboolean      compacting; /* the file is compacted in a worker thread */
+    gboolean      folding;    /* the own shard is folded into the file */
+    gboolean      lazy;       /* not read yet, queries go to the store */
+} HistoryIndex;
+
+static HistoryIndex *get_index(HistoryType type);
+static gboolean journal_flush(HistoryType type);
+static gboolean journal_flush_cb(gpointer data);
+static void index_clear(HistoryIndex *hi);
+static void index_parse(HistoryIndex *hi, char *content, gint64 mtime);
+static void index_insert(HistoryIndex *hi, const char *first, const char *second,
+    guint visits, gint64 lastvisit);
+static gboolean parse_visits(char *data, guint *visits, gint64 *lastvisit);
+static gint64 file_mtime(const char *file);
+static void index_trim(HistoryIndex *hi);
+static gboolean shard_open(HistoryIndex *hi);
+static void shard_close(HistoryIndex *hi);
+static gboolean shard_read(HistoryIndex *hi, gboolean fold);
+static gboolean shard_foldable(HistoryShard *shard);
+static guint foldable_lines(HistoryIndex *hi, guint *gone, guint *live);
+static int shard_line_cmp(gconstpointer a, gconstpointer b);
+static void free_shard(HistoryShard *shard);
+static void trigram_add(HistoryIndex *hi, History *item);
+static void trigram_add_text(HistoryIndex *hi, const char *text, guint id);
+static void trigram_remove(HistoryIndex *hi, History *item);
+static void trigram_rebuild(HistoryIndex *hi);
+static GArray *trigram_lookup(HistoryIndex *hi, char **query, unsigned int qlen);
+static int trigram_cmp_len(gconstpointer a, gconstpointer b);
+static void free_postings(GArray *postings);
+static gboolean needs_compaction(HistoryIndex *hi);
+static void compact_start(HistoryType type);
+static void compact_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable);
+static gboolean compact(HistoryType type);
+static gboolean contains_all_tags(const char *first, const char *second,
+    char **query, unsigned int qlen);
+static gboolean match_tags(const char *first, const char *data, char **query);
+static double frecency(guint visits, gint64 lastvisit);
+static void rank_push(GPtrArray *heap, History *item);
+static int rank_cmp(History *a, History *b);
+static int rank_cmp_desc(gconstpointer a, gconstpointer b);
+static void query_ranked(CompletionQuery *query, GPtrArray *heap);
 static History *line_to_history(const char *uri, const char *title);
 static void free_history(History *item);
 
+/* no shard is open before history_init() */
+static HistoryIndex histindex[HISTORY_LAST] = {
+    [HISTORY_COMMAND] = {.shardfd = -1},
+    [HISTORY_SEARCH]  = {.shardfd = -1},
+    [HISTORY_URL]     = {.shardfd = -1},
+};
+/* guards the index against the completion running in worker threads */
+G_LOCK_DEFINE_STATIC(histindex);
+/* signalled with the histindex lock if a compaction thread is finished */
+static GCond compact_cond;
+/* guards the journals and the journal_flush_id */
+G_LOCK_DEFINE_STATIC(journal);
+/* idle source to write the journals */
+static guint journal_flush_id;
+
 
 /**
- * Makes all history items unique and force them to fit the maximum history
- * size and writes all entries of the different history types to file.
+ * Builds the in memory index of all history types from the history files.
  */
-void history_cleanup(void)
+void history_init(void)
 {
-    const char *file;
-    GList *list;
+    char *name;
+
+    /* only the URL history is matched by tags */
+    histindex[HISTORY_URL].trigrams = g_hash_table_new_full(
+        g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)free_postings
+    );
+    histindex[HISTORY_URL].ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    histindex[HISTORY_URL].ranked = true;
 
-    /* don't cleanup the history file if history max size is 0 */
-    if (!vb.config.history_max) {
+    /* the process id alone could be reused by a later instance */
+    name = g_strdup_printf("%d-%08x", getpid(), g_random_int());
+    for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+        histindex[i].items    = g_queue_new();
+        histindex[i].lookup   = g_hash_table_new(g_str_hash, g_str_equal);
+        histindex[i].shards   = g_hash_table_new_full(
+            g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_shard
+        );
+        histindex[i].sharddir = g_strconcat(HIST_FILE(i), ".d", NULL);
+        histindex[i].shard    = g_build_filename(histindex[i].sharddir, name, NULL);
+        histindex[i].shardfd  = -1;
+        util_create_dir_if_not_exists(histindex[i].sharddir);
+    }
+    g_free(name);
+#ifdef FEATURE_SHARED_STORE
+    /* the completion is answered by the instance holding the shared store,
+     * the index is read only if it's needed anyway */
+    if (store_is_client()) {
+        for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+            histindex[i].lazy = true;
+        }
         return;
     }
+#endif
+    G_LOCK(histindex);
+    for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+        if (needs_compaction(get_index(i))) {
+            compact_start(i);
+        }
+    }
+    G_UNLOCK(histindex);
+}
 
+/**
+ * Writes the added history entries and compacts the history files if they
+ * hold too many duplicate or outdated entries or if this is the last running
+ * instance.
+ */
+void history_cleanup(void)
+{
+    HistoryIndex *hi;
+    guint live;
+
+    G_LOCK(histindex);
+    /* wait for the running compactions, they use the index */
+    for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+        while (histindex[i].compacting) {
+            g_cond_wait(&compact_cond, &G_LOCK_NAME(histindex));
+        }
+    }
+    G_LOCK(journal);
+    if (journal_flush_id) {
+        g_source_remove(journal_flush_id);
+        journal_flush_id = 0;
+    }
+    G_UNLOCK(journal);
     for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
-        file = HIST_FILE(i);
-        list = load(file);
-        write_to_file(list, file);
-        g_list_free_full(list, (GDestroyNotify)free_history);
+        /* write the added entries even if there is no index */
+        journal_flush(i);
+        if (!histindex[i].items) {
+            continue;
+        }
+        /* don't cleanup the history file if history max size is 0, a not
+         * read index is left to the instance holding the store */
+        if (vb.config.history_max && !histindex[i].lazy) {
+            hi = get_index(i);
+            /* The file is usually compacted during the session already. The
+             * last running instance folds all shards into the file, the
+             * shard of others is folded later. */
+            foldable_lines(hi, NULL, &live);
+            if (needs_compaction(hi) || (g_hash_table_size(hi->shards) && !live)) {
+                compact(i);
+            }
+        }
+        /* an own shard left is folded by another instance later */
+        shard_close(&histindex[i]);
+        index_clear(&histindex[i]);
+        memset(&histindex[i].state, 0, sizeof(UtilFileState));
+        g_queue_free(histindex[i].items);
+        g_hash_table_destroy(histindex[i].lookup);
+        g_hash_table_destroy(histindex[i].shards);
+        g_free(histindex[i].sharddir);
+        g_free(histindex[i].shard);
+        histindex[i].shard = NULL;
+        histindex[i].items = NULL;
+        if (histindex[i].trigrams) {
+            g_hash_table_destroy(histindex[i].trigrams);
+            g_hash_table_destroy(histindex[i].ids);
+            histindex[i].trigrams = NULL;
+        }
     }
+    G_UNLOCK(histindex);
 }
 
 /**
- * Write a new history entry to the end of history file.
+ * Adds a new history entry. The entries are buffered and appended to the own
+ * shard together when vimb is idle or the buffer is full.
  */
 void history_add(HistoryType type, const char *value, const char *additional)
 {
-    const char *file;
+    HistoryIndex *hi = &histindex[type];
+    gboolean full;
 
     /* Don't write a history entry if the history max size is set to 0. Else
-     * skip command history in case the command was not typed by the user. */
-    if (!vb.config.history_max || (!vb.state.typed && type == HISTORY_COMMAND)) {
+     * skip command history in case the command was not typed by the user.
+     * Without a shard the history is not initialized. */
+    if (!vb.config.history_max || (!vb.state.typed && type == HISTORY_COMMAND)
+        || !hi->shard
+    ) {
         return;
     }
 
-    file = HIST_FILE(type);
+    G_LOCK(journal);
+    if (!hi->journal) {
+        hi->journal = g_string_sized_new(JOURNAL_FLUSH_SIZE);
+    }
+    /* The lines are collected and written to the shard later together. They
+     * are read into the index from the shard like those of other instances,
+     * so that the index does not count the visits twice. Each line counts as
+     * one visit at the time it was added. */
+    g_string_append_printf(
+        hi->journal, "%" G_GINT64_FORMAT "\t%s", (gint64)time(NULL), value
+    );
     if (additional) {
-        util_file_append(file, "%s\t%s\n", value, additional);
-    } else {
-        util_file_append(file, "%s\n", value);
+        g_string_append_printf(hi->journal, "\t%s", additional);
+    }
+    g_string_append_c(hi->journal, '\n');
+    full = hi->journal->len >= JOURNAL_FLUSH_SIZE;
+    if (!journal_flush_id) {
+        journal_flush_id = g_idle_add_full(G_PRIORITY_LOW, journal_flush_cb, NULL, NULL);
+    }
+    G_UNLOCK(journal);
+
+    /* write a full journal at once, if the file is not compacted now */
+    if (full && G_TRYLOCK(histindex)) {
+        journal_flush(type);
+        G_UNLOCK(histindex);
     }
 }
 
-gboolean history_fill_completion(GtkListStore *store, HistoryType type, const char *input)
+/**
+ * Writes all the added history entries to the history files.
+ */
+void history_flush(void)
+{
+    G_LOCK(histindex);
+    for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+        journal_flush(i);
+    }
+    G_UNLOCK(histindex);
+}
+
+/**
+ * Completion provider for the history type given as data. This is run in a
+ * worker thread.
+ */
+void history_query_completion(CompletionQuery *query, const char *input,
+    gpointer data)
 {
     char **parts;
-    unsigned int len;
-    gboolean found = false;
-    GList *src = NULL;
-    GtkTreeIter iter;
+    unsigned int len, i;
+    HistoryIndex *hi;
     History *item;
+    GArray *ids;
+    GPtrArray *heap;
 
-    src = load(HIST_FILE(type));
-    src = g_list_reverse(src);
-    if (!input || !*input) {
-        /* without any tags return all items */
-        for (GList *l = src; l; l = l->next) {
-            item = l->data;
-            gtk_list_store_append(store, &iter);
-            gtk_list_store_set(
-                store, &iter,
-                COMPLETION_STORE_FIRST, item->first,
-#ifdef FEATURE_TITLE_IN_COMPLETION
-                COMPLETION_STORE_SECOND, item->second,
+#ifdef FEATURE_SHARED_STORE
+    /* let the store see the own added entries too */
+    G_LOCK(histindex);
+    journal_flush(GPOINTER_TO_INT(data));
+    G_UNLOCK(histindex);
+    if (store_query(query, STORE_HISTORY, GPOINTER_TO_INT(data), input)) {
+        return;
+    }
 #endif
-                -1
-            );
-            found = true;
-        }
-    } else if (HISTORY_URL == type) {
-        parts = g_strsplit(input, " ", 0);
-        len   = g_strv_length(parts);
 
-        for (GList *l = src; l; l = l->next) {
-            item = l->data;
-            if (history_item_contains_all_tags(item, parts, len)) {
-                gtk_list_store_append(store, &iter);
-                gtk_list_store_set(
-                    store, &iter,
-                    COMPLETION_STORE_FIRST, item->first,
-#ifdef FEATURE_TITLE_IN_COMPLETION
-                    COMPLETION_STORE_SECOND, item->second,
-#endif
-                    -1
-                );
-                found = true;
+    G_LOCK(histindex);
+    if (!histindex[GPOINTER_TO_INT(data)].items) {
+        G_UNLOCK(histindex);
+        return;
+    }
+    hi = get_index(GPOINTER_TO_INT(data));
+    if (hi->ranked) {
+        /* collect the best ranked items only */
+        heap = g_ptr_array_sized_new(HISTORY_COMPLETION_MAX);
+        if (!input || !*input) {
+            for (GList *l = hi->items->head; l && !completion_query_cancelled(query); l = l->next) {
+                rank_push(heap, l->data);
+            }
+        } else {
+            parts = g_strsplit(input, " ", 0);
+            len   = g_strv_length(parts);
+
+            if ((ids = trigram_lookup(hi, parts, len))) {
+                /* The trigrams do not respect the word boundaries, so each
+                 * candidate must be checked. */
+                for (i = 0; i < ids->len && !completion_query_cancelled(query); i++) {
+                    item = g_hash_table_lookup(
+                        hi->ids, GUINT_TO_POINTER(g_array_index(ids, guint, i))
+                    );
+                    if (item && contains_all_tags(item->first, item->second, parts, len)) {
+                        rank_push(heap, item);
+                    }
+                }
+                g_array_free(ids, true);
+            } else {
+                /* all tags are too short for the trigram index */
+                for (GList *l = hi->items->head; l && !completion_query_cancelled(query); l = l->next) {
+                    item = l->data;
+                    if (contains_all_tags(item->first, item->second, parts, len)) {
+                        rank_push(heap, item);
+                    }
+                }
             }
+            g_strfreev(parts);
         }
-        g_strfreev(parts);
+
+        query_ranked(query, heap);
     } else {
-        for (GList *l = src; l; l = l->next) {
+        for (GList *l = hi->items->tail; l && !completion_query_cancelled(query); l = l->prev) {
             item = l->data;
-            if (g_str_has_prefix(item->first, input)) {
-                gtk_list_store_append(store, &iter);
-                gtk_list_store_set(
-                    store, &iter,
-                    COMPLETION_STORE_FIRST, item->first,
-#ifdef FEATURE_TITLE_IN_COMPLETION
-                    COMPLETION_STORE_SECOND, item->second,
-#endif
-                    -1
-                );
-                found = true;
+            if (!input || g_str_has_prefix(item->first, input)) {
+                completion_query_add(query, item->first, item->second, item->second);
             }
         }
     }
-    g_list_free_full(src, (GDestroyNotify)free_history);
+    G_UNLOCK(histindex);
+}
+
+/**
+ * Removes the items from the store of a previous URL history completion that
+ * do not contain all tags of given input. Returns false if the store can't be
+ * narrowed, because it may not hold all items that match the input.
+ */
+gboolean history_narrow_completion(GtkListStore *store, const char *input)
+{
+    char **parts;
+
+    /* a full store holds only the best ranked of more matching items */
+    if (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(store), NULL) >= HISTORY_COMPLETION_MAX) {
+        return false;
+    }
+
+    parts = g_strsplit(input, " ", 0);
+    completion_narrow(store, (CompletionMatchFunc)match_tags, parts);
+    g_strfreev(parts);
 
-    return found;
+    return true;
 }
 
 /**
@@ -164,30 +449,33 @@ gboolean history_fill_completion(GtkListStore *store, HistoryType type, const ch
  */
 GList *history_get_list(VbInputType type, const char *query)
 {
-    GList *result = NULL, *src = NULL;
+    GList *result = NULL;
+    HistoryIndex *hi;
 
+    G_LOCK(histindex);
     switch (type) {
         case VB_INPUT_COMMAND:
-            src = load(HIST_FILE(HISTORY_COMMAND));
+            hi = get_index(HISTORY_COMMAND);
             break;
 
         case VB_INPUT_SEARCH_FORWARD:
         case VB_INPUT_SEARCH_BACKWARD:
-            src = load(HIST_FILE(HISTORY_SEARCH));
+            hi = get_index(HISTORY_SEARCH);
             break;
 
         default:
+            G_UNLOCK(histindex);
             return NULL;
     }
 
     /* generate new history list with the matching items */
-    for (GList *l = src; l; l = l->next) {
+    for (GList *l = hi->items->head; l; l = l->next) {
         History *item = l->data;
         if (g_str_has_prefix(item->first, query)) {
             result = g_list_prepend(result, g_strdup(item->first));
         }
     }
-    g_list_free_full(src, (GDestroyNotify)free_history);
+    G_UNLOCK(histindex);
 
     /* Prepend the original query as own item like done in vim to have the
      * original input string in input box if we step before the first real
@@ -198,46 +486,781 @@ GList *history_get_list(VbInputType type, const char *query)
 }
 
 /**
- * Loads history items form file but eleminate duplicates in FIFO order.
+ * Retrieves the index of given history type after the lines appended to the
+ * shards by all instances are added. If the history file was rewritten or a
+ * shard was folded into it in the meantime the index is rebuilt from
+ * scratch.
+ */
+static HistoryIndex *get_index(HistoryType type)
+{
+    HistoryIndex *hi = &histindex[type];
+    UtilFileChange change;
+    char *content;
+
+    /* the own added lines are read from the shard too */
+    journal_flush(type);
+    hi->lazy = false;
+
+    while (true) {
+        content = util_file_read_new(HIST_FILE(type), &hi->state, &change);
+        if (change == UTIL_FILE_REPLACED) {
+            index_clear(hi);
+        }
+        if (content) {
+            index_parse(hi, content, file_mtime(HIST_FILE(type)));
+            g_free(content);
+        }
+        if (shard_read(hi, false)) {
+            break;
+        }
+        /* the lines of a shard folded into the history file can't be told
+         * apart from these in the index */
+        index_clear(hi);
+        memset(&hi->state, 0, sizeof(UtilFileState));
+    }
+    index_trim(hi);
+
+    /* drop the postings of removed and updated items if they are too many */
+    if (hi->trigrams && hi->stale > MAX(TRIGRAM_STALE_MIN, hi->items->length)) {
+        trigram_rebuild(hi);
+    }
+
+    return hi;
+}
+
+/**
+ * Appends the buffered lines of given history type to the own shard. The
+ * caller must hold the histindex lock. While the shard is folded into the
+ * history file, the lines are kept buffered, because they would get lost
+ * with the removed shard.
  *
- * Returned list must be freed with (GDestroyNotify)free_history.
+ * Returns true if there were buffered lines written.
  */
-static GList *load(const char *file)
+static gboolean journal_flush(HistoryType type)
 {
-    return util_file_to_unique_list(
-        file, (Util_Content_Func)line_to_history, vb.config.history_max
-    );
+    HistoryIndex *hi = &histindex[type];
+    GString *journal;
+    const char *p;
+    gssize n;
+    gsize len;
+
+    if (hi->folding || !hi->shard) {
+        return false;
+    }
+
+    /* the file is written without blocking further additions */
+    G_LOCK(journal);
+    journal     = hi->journal;
+    hi->journal = NULL;
+    G_UNLOCK(journal);
+
+    if (!journal) {
+        return false;
+    }
+    p   = journal->str;
+    len = journal->len;
+    if (len && shard_open(hi)) {
+        /* a short write leaves the rest of the lines to write */
+        while (len) {
+            if ((n = write(hi->shardfd, p, len)) > 0) {
+                p   += n;
+                len -= n;
+            } else if (n == 0 || errno != EINTR) {
+                break;
+            }
+        }
+    }
+    if (len) {
+        g_warning("Can't write history to %s: %s", hi->shard, g_strerror(errno));
+    }
+    g_string_free(journal, true);
+
+    return true;
+}
+
+static gboolean journal_flush_cb(gpointer data)
+{
+    /* try again later if the history is compacted right now */
+    if (!G_TRYLOCK(histindex)) {
+        G_LOCK(journal);
+        journal_flush_id = g_timeout_add(JOURNAL_RETRY_DELAY, journal_flush_cb, NULL);
+        G_UNLOCK(journal);
+
+        return false;
+    }
+    G_LOCK(journal);
+    journal_flush_id = 0;
+    G_UNLOCK(journal);
+
+    for (HistoryType i = HISTORY_FIRST; i < HISTORY_LAST; i++) {
+        /* the shards grow mostly by the flushed lines */
+        if (journal_flush(i) && !histindex[i].lazy && needs_compaction(get_index(i))) {
+            compact_start(i);
+        }
+        /* write the lines kept during the folding later */
+        G_LOCK(journal);
+        if (histindex[i].journal && !journal_flush_id) {
+            journal_flush_id = g_timeout_add(JOURNAL_RETRY_DELAY, journal_flush_cb, NULL);
+        }
+        G_UNLOCK(journal);
+    }
+    G_UNLOCK(histindex);
+
+    return false;
+}
+
+/**
+ * Removes all items from the index. The shards are read from the start the
+ * next time.
+ */
+static void index_clear(HistoryIndex *hi)
+{
+    if (hi->trigrams) {
+        g_hash_table_remove_all(hi->trigrams);
+        g_hash_table_remove_all(hi->ids);
+        hi->stale = 0;
+    }
+    g_hash_table_remove_all(hi->lookup);
+    g_queue_foreach(hi->items, (GFunc)free_history, NULL);
+    g_queue_clear(hi->items);
+    g_hash_table_remove_all(hi->shards);
+    hi->lines = 0;
+}
+
+/**
+ * Adds the history lines of given content to the index. The content is
+ * modified during the parsing. Lines without visit time count as visited at
+ * given modification time of the file.
+ */
+static void index_parse(HistoryIndex *hi, char *content, gint64 mtime)
+{
+    char *line, *next, *data;
+    guint visits;
+    gint64 lastvisit;
+
+    for (line = content; line; line = next) {
+        if ((next = strchr(line, '\n'))) {
+            *next++ = '\0';
+        }
+        g_strstrip(line);
+        if (!*line) {
+            continue;
+        }
+        hi->lines++;
+        /* if line contains tab char - separate the line at this */
+        if ((data = strchr(line, '\t'))) {
+            *data++ = '\0';
+        }
+        /* lines written before the visits were recorded count as single
+         * visit at the time the file was last written, else they would be
+         * ranked far below all recent visits */
+        if (!hi->ranked || !data || !parse_visits(data, &visits, &lastvisit)) {
+            visits    = 1;
+            lastvisit = mtime;
+        }
+        index_insert(hi, line, data && *data ? data : NULL, visits, lastvisit);
+    }
+}
+
+/**
+ * Parses the visit count and the time of the last visit from the end of the
+ * data of a history line in the form "title\tvisits\tlastvisit" and removes
+ * them from the data.
+ */
+static gboolean parse_visits(char *data, guint *visits, gint64 *lastvisit)
+{
+    char *p, *end;
+
+    if (!(p = strrchr(data, '\t')) || !VB_IS_DIGIT(p[1])) {
+        return false;
+    }
+    *lastvisit = g_ascii_strtoll(p + 1, &end, 10);
+    if (*end) {
+        return false;
+    }
+    *p = '\0';
+    if (!(p = strrchr(data, '\t')) || !VB_IS_DIGIT(p[1])) {
+        data[strlen(data)] = '\t';
+        return false;
+    }
+    *visits = g_ascii_strtoull(p + 1, &end, 10);
+    if (*end) {
+        data[strlen(data)] = '\t';
+        return false;
+    }
+    *p = '\0';
+
+    return true;
+}
+
+/**
+ * Returns the modification time of given file or the current time if the
+ * file does not exist.
+ */
+static gint64 file_mtime(const char *file)
+{
+    struct stat st;
+
+    return stat(file, &st) ? (gint64)time(NULL) : (gint64)st.st_mtime;
+}
+
+/**
+ * Adds a new item to the end of the index. If there is already an item with
+ * the same key, this is moved to the end, gets the new data and the visits
+ * are added.
+ */
+static void index_insert(HistoryIndex *hi, const char *first, const char *second,
+    guint visits, gint64 lastvisit)
+{
+    History *item;
+
+    if ((item = g_hash_table_lookup(hi->lookup, first))) {
+        if (hi->trigrams) {
+            trigram_remove(hi, item);
+        }
+        OVERWRITE_STRING(item->second, second);
+        g_queue_unlink(hi->items, item->link);
+        g_queue_push_tail_link(hi->items, item->link);
+
+        item->visits   += visits;
+        item->lastvisit = MAX(item->lastvisit, lastvisit);
+    } else {
+        item = line_to_history(first, second);
+        g_queue_push_tail(hi->items, item);
+        item->link = hi->items->tail;
+        g_hash_table_insert(hi->lookup, item->first, item);
+
+        item->visits    = visits;
+        item->lastvisit = lastvisit;
+    }
+    if (hi->ranked) {
+        item->rank = frecency(item->visits, item->lastvisit);
+    }
+    if (hi->trigrams) {
+        trigram_add(hi, item);
+    }
+}
+
+/**
+ * Removes the oldest items from the index to fit the maximum history size.
+ */
+static void index_trim(HistoryIndex *hi)
+{
+    History *item;
+
+    while (vb.config.history_max && hi->items->length > vb.config.history_max) {
+        item = g_queue_pop_head(hi->items);
+        g_hash_table_remove(hi->lookup, item->first);
+        if (hi->trigrams) {
+            trigram_remove(hi, item);
+        }
+        free_history(item);
+    }
+}
+
+/**
+ * Creates the own shard if it does not exist yet. The shard is locked shared
+ * as long as this instance runs, so that the other instances don't fold it.
+ * It is created under a hidden name and is renamed once it is locked.
+ */
+static gboolean shard_open(HistoryIndex *hi)
+{
+    char *name, *tmp;
+    int fd;
+
+    if (hi->shardfd != -1) {
+        return true;
+    }
+    name = g_path_get_basename(hi->shard);
+    tmp  = g_strdup_printf("%s/.%s", hi->sharddir, name);
+    g_free(name);
+
+    if ((fd = open(tmp, O_WRONLY|O_APPEND|O_CREAT|O_TRUNC, 0600)) == -1) {
+        g_free(tmp);
+        return false;
+    }
+    if (flock(fd, LOCK_SH) == -1 || rename(tmp, hi->shard) == -1) {
+        unlink(tmp);
+        close(fd);
+        g_free(tmp);
+        return false;
+    }
+    g_free(tmp);
+    hi->shardfd = fd;
+
+    return true;
+}
+
+/**
+ * Closes the own shard, which releases its lock.
+ */
+static void shard_close(HistoryIndex *hi)
+{
+    if (hi->shardfd != -1) {
+        close(hi->shardfd);
+        hi->shardfd = -1;
+    }
+}
+
+/**
+ * Adds the lines appended to the shards since the last call to the index.
+ * The new lines of all shards are merged by the time they were added. If fold
+ * is set, only the shards that can be folded into the history file are read.
+ *
+ * Returns false if a shard was rewritten or removed in the meantime, in this
+ * case the index has to be rebuilt.
+ */
+static gboolean shard_read(HistoryIndex *hi, gboolean fold)
+{
+    GHashTableIter iter;
+    HistoryShard *shard;
+    UtilFileChange change;
+    ShardLine sl;
+    GArray *lines;
+    GPtrArray *contents;
+    GDir *dir;
+    const char *name;
+    char *content, *line, *next, *end, *data;
+    gboolean ok = true;
+
+    lines    = g_array_new(false, false, sizeof(ShardLine));
+    contents = g_ptr_array_new_with_free_func(g_free);
+    if ((dir = g_dir_open(hi->sharddir, 0, NULL))) {
+        while (ok && (name = g_dir_read_name(dir))) {
+            /* hidden shards are not locked yet */
+            if (*name == '.') {
+                continue;
+            }
+            if (!(shard = g_hash_table_lookup(hi->shards, name))) {
+                shard       = g_slice_new0(HistoryShard);
+                shard->file = g_build_filename(hi->sharddir, name, NULL);
+                shard->own  = !strcmp(shard->file, hi->shard);
+                if (fold && !shard_foldable(shard)) {
+                    free_shard(shard);
+                    continue;
+                }
+                g_hash_table_insert(hi->shards, g_strdup(name), shard);
+            }
+            shard->seen = true;
+
+            content = util_file_read_new(shard->file, &shard->state, &change);
+            if (change == UTIL_FILE_REPLACED) {
+                g_free(content);
+                ok = false;
+            } else if (content) {
+                g_ptr_array_add(contents, content);
+            }
+            for (line = content; ok && line; line = next) {
+                if ((next = strchr(line, '\n'))) {
+                    *next++ = '\0';
+                }
+                g_strstrip(line);
+                if (!*line) {
+                    continue;
+                }
+                shard->lines++;
+                /* each line starts with the time it was added */
+                sl.time = g_ascii_strtoll(line, &end, 10);
+                if (*end == '\t') {
+                    sl.pos  = lines->len;
+                    sl.line = end + 1;
+                    g_array_append_val(lines, sl);
+                }
+            }
+        }
+        g_dir_close(dir);
+    }
+
+    /* a vanished shard with lines was folded into the history file */
+    g_hash_table_iter_init(&iter, hi->shards);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&shard)) {
+        if (shard->seen) {
+            shard->seen = false;
+        } else {
+            ok = ok && !shard->state.size;
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    if (ok) {
+        g_array_sort(lines, shard_line_cmp);
+        for (guint i = 0; i < lines->len; i++) {
+            sl = g_array_index(lines, ShardLine, i);
+            if ((data = strchr(sl.line, '\t'))) {
+                *data++ = '\0';
+            }
+            index_insert(hi, sl.line, data && *data ? data : NULL, 1, sl.time);
+        }
+    }
+    g_array_free(lines, true);
+    g_ptr_array_free(contents, true);
+
+    return ok;
+}
+
+/**
+ * Checks if the shard can be folded into the history file. This is true for
+ * the own shard and the shards of instances that are gone. These don't hold
+ * the shared lock on their shard anymore.
+ */
+static gboolean shard_foldable(HistoryShard *shard)
+{
+    int fd;
+
+    /* a quit instance does not come back */
+    if (!shard->own && !shard->gone && (fd = open(shard->file, O_RDONLY)) != -1) {
+        shard->gone = !flock(fd, LOCK_EX|LOCK_NB);
+        close(fd);
+    }
+
+    return shard->own || shard->gone;
+}
+
+/**
+ * Counts the lines of the history file and the shards that can be folded
+ * into it. If given, gone is set to the number of shards of quit instances
+ * and live to the number of shards of other running instances.
+ */
+static guint foldable_lines(HistoryIndex *hi, guint *gone, guint *live)
+{
+    GHashTableIter iter;
+    HistoryShard *shard;
+    guint lines = hi->lines, g = 0, l = 0;
+
+    g_hash_table_iter_init(&iter, hi->shards);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&shard)) {
+        if (shard->own) {
+            lines += shard->lines;
+        } else if (shard_foldable(shard)) {
+            lines += shard->lines;
+            g++;
+        } else {
+            l++;
+        }
+    }
+    if (gone) {
+        *gone = g;
+    }
+    if (live) {
+        *live = l;
+    }
+
+    return lines;
+}
+
+static int shard_line_cmp(gconstpointer a, gconstpointer b)
+{
+    const ShardLine *x = a, *y = b;
+
+    if (x->time != y->time) {
+        return x->time < y->time ? -1 : 1;
+    }
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+static void free_shard(HistoryShard *shard)
+{
+    g_free(shard->file);
+    g_slice_free(HistoryShard, shard);
+}
+
+/**
+ * Gives the item a new id and adds it to the postings of all trigrams of its
+ * texts. Because the new id is the highest one, the postings stay sorted.
+ */
+static void trigram_add(HistoryIndex *hi, History *item)
+{
+    item->id = ++hi->nextid;
+    g_hash_table_insert(hi->ids, GUINT_TO_POINTER(item->id), item);
+
+    trigram_add_text(hi, item->first, item->id);
+    if (item->second) {
+        trigram_add_text(hi, item->second, item->id);
+    }
+}
+
+static void trigram_add_text(HistoryIndex *hi, const char *text, guint id)
+{
+    GArray *postings;
+    gpointer key;
+
+    for (; text[0] && text[1] && text[2]; text++) {
+        key = GUINT_TO_POINTER(TRIGRAM(text));
+        if (!(postings = g_hash_table_lookup(hi->trigrams, key))) {
+            postings = g_array_new(false, false, sizeof(guint));
+            g_hash_table_insert(hi->trigrams, key, postings);
+        }
+        /* the id is the last one if the trigram was already found before */
+        if (!postings->len || g_array_index(postings, guint, postings->len - 1) != id) {
+            g_array_append_val(postings, id);
+        }
+    }
+}
+
+/**
+ * Marks the id of given item as stale. The postings of the id are removed
+ * later by trigram_rebuild().
+ */
+static void trigram_remove(HistoryIndex *hi, History *item)
+{
+    g_hash_table_remove(hi->ids, GUINT_TO_POINTER(item->id));
+    hi->stale++;
+}
+
+/**
+ * Recreates the trigram postings of all items in the index.
+ */
+static void trigram_rebuild(HistoryIndex *hi)
+{
+    g_hash_table_remove_all(hi->trigrams);
+    g_hash_table_remove_all(hi->ids);
+    hi->stale  = 0;
+    hi->nextid = 0;
+
+    for (GList *l = hi->items->head; l; l = l->next) {
+        trigram_add(hi, l->data);
+    }
+}
+
+/**
+ * Retrieves the sorted ids of the items that contain all trigrams of the
+ * given query words. Returns NULL if none of the words is long enough to
+ * have a trigram, in this case all items have to be checked.
+ *
+ * Returned array must be freed with g_array_free().
+ */
+static GArray *trigram_lookup(HistoryIndex *hi, char **query, unsigned int qlen)
+{
+    GPtrArray *lists;
+    GArray *postings, *result;
+    const char *p;
+    guint i, j, n, lo, hi_pos, mid, id;
+
+    lists = g_ptr_array_new();
+    for (i = 0; i < qlen; i++) {
+        for (p = query[i]; p[0] && p[1] && p[2]; p++) {
+            postings = g_hash_table_lookup(hi->trigrams, GUINT_TO_POINTER(TRIGRAM(p)));
+            if (!postings) {
+                /* no item contains the trigram */
+                g_ptr_array_free(lists, true);
+                return g_array_new(false, false, sizeof(guint));
+            }
+            g_ptr_array_add(lists, postings);
+        }
+    }
+    if (!lists->len) {
+        g_ptr_array_free(lists, true);
+        return NULL;
+    }
+
+    /* start with the shortest list to keep the intersection small */
+    g_ptr_array_sort(lists, trigram_cmp_len);
+    postings = g_ptr_array_index(lists, 0);
+    result   = g_array_sized_new(false, false, sizeof(guint), postings->len);
+    g_array_append_vals(result, postings->data, postings->len);
+
+    for (i = 1; i < lists->len && result->len; i++) {
+        postings = g_ptr_array_index(lists, i);
+        lo       = 0;
+        for (j = n = 0; j < result->len; j++) {
+            id = g_array_index(result, guint, j);
+            /* binary search for the id starting after the last found one */
+            hi_pos = postings->len;
+            while (lo < hi_pos) {
+                mid = lo + (hi_pos - lo) / 2;
+                if (g_array_index(postings, guint, mid) < id) {
+                    lo = mid + 1;
+                } else {
+                    hi_pos = mid;
+                }
+            }
+            if (lo == postings->len) {
+                break;
+            }
+            if (g_array_index(postings, guint, lo) == id) {
+                g_array_index(result, guint, n++) = id;
+            }
+        }
+        g_array_set_size(result, n);
+    }
+    g_ptr_array_free(lists, true);
+
+    return result;
+}
+
+static int trigram_cmp_len(gconstpointer a, gconstpointer b)
+{
+    return (*(GArray**)a)->len - (*(GArray**)b)->len;
+}
+
+static void free_postings(GArray *postings)
+{
+    g_array_free(postings, true);
+}
+
+/**
+ * Checks if the history file and the shards that can be folded into it hold
+ * so many duplicate or outdated lines or if there are so many shards of quit
+ * instances that the history file should be compacted.
+ */
+static gboolean needs_compaction(HistoryIndex *hi)
+{
+    guint lines, gone;
+
+    if (!vb.config.history_max || hi->compacting) {
+        return false;
+    }
+    lines = foldable_lines(hi, &gone, NULL);
+
+    return gone >= COMPACT_MAX_SHARDS
+        || (lines >= COMPACT_MIN_LINES && lines > hi->items->length * COMPACT_RATIO);
 }
 
 /**
- * Loads the entries from file, make them unique and write them back to file.
+ * Starts the compaction of the history file in a worker thread. The caller
+ * must hold the histindex lock.
  */
-static void write_to_file(GList *list, const char *file)
+static void compact_start(HistoryType type)
 {
-    FILE *f;
-    if ((f = fopen(file, "w"))) {
-        FLOCK(fileno(f), F_WRLCK);
+    GTask *task;
+
+    histindex[type].compacting = true;
 
-        /* overwrite the history file with new unique history items */
-        for (GList *link = list; link; link = link->next) {
+    task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, GINT_TO_POINTER(type), NULL);
+    g_task_run_in_thread(task, compact_thread);
+    g_object_unref(task);
+}
+
+static void compact_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable)
+{
+    HistoryType type = GPOINTER_TO_INT(data);
+
+    G_LOCK(histindex);
+    compact(type);
+    /* rebuild a cleared index here instead of on the next query */
+    get_index(type);
+    histindex[type].compacting = false;
+    g_cond_broadcast(&compact_cond);
+    G_UNLOCK(histindex);
+
+    g_task_return_boolean(task, true);
+}
+
+/**
+ * Folds the own shard and the shards of quit instances into the history
+ * file, which is replaced by a file with the unique items of these. The
+ * shards of other running instances are left untouched. The caller must
+ * hold the histindex lock, which is released while the file is written.
+ *
+ * Returns false if the file could not be replaced.
+ */
+static gboolean compact(HistoryType type)
+{
+    HistoryIndex *hi = get_index(type), fold = {0};
+    GHashTableIter iter;
+    HistoryShard *shard, *known;
+    UtilFileChange change;
+    UtilFileState read = {0};
+    GString *content;
+    char *data, *name;
+    guint count = 0;
+    gboolean done;
+
+    /* The items of the folded files are read again, because the index holds
+     * the items of the shards of other instances too. */
+    fold.items    = g_queue_new();
+    fold.lookup   = g_hash_table_new(g_str_hash, g_str_equal);
+    fold.shards   = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_shard
+    );
+    fold.sharddir = hi->sharddir;
+    fold.shard    = hi->shard;
+    fold.ranked   = hi->ranked;
+    if ((data = util_file_read_new(HIST_FILE(type), &fold.state, &change))) {
+        index_parse(&fold, data, file_mtime(HIST_FILE(type)));
+        g_free(data);
+    }
+    done = shard_read(&fold, true);
+    index_trim(&fold);
+
+    if (done) {
+        content = g_string_sized_new(fold.state.size);
+        for (GList *link = fold.items->head; link; link = link->next) {
             History *item = link->data;
-            if (item->second) {
-                fprintf(f, "%s\t%s\n", item->first, item->second);
+            if (fold.ranked) {
+                g_string_append_printf(
+                    content, "%s\t%s\t%u\t%" G_GINT64_FORMAT "\n", item->first,
+                    item->second ? item->second : "", item->visits, item->lastvisit
+                );
+            } else if (item->second) {
+                g_string_append_printf(content, "%s\t%s\n", item->first, item->second);
             } else {
-                fprintf(f, "%s\n", item->first);
+                g_string_append_printf(content, "%s\n", item->first);
             }
         }
+        read = fold.state;
 
-        FLOCK(fileno(f), F_UNLCK);
-        fclose(f);
+        /* The files are written without the lock to not block the queries.
+         * The own shard is not appended until it is removed. The file is not
+         * replaced if another instance has compacted it in the meantime. */
+        hi->folding = true;
+        G_UNLOCK(histindex);
+        done = util_file_replace(HIST_FILE(type), content->str, content->len, &fold.state);
+        if (done) {
+            /* the folded shards are part of the history file now */
+            g_hash_table_iter_init(&iter, fold.shards);
+            while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&shard)) {
+                unlink(shard->file);
+            }
+        }
+        G_LOCK(histindex);
+        hi->folding = false;
+        if (done) {
+            /* the own shard is created again with the next added lines */
+            shard_close(hi);
+        }
+        g_string_free(content, true);
     }
+
+    if (done) {
+        /* the index may have read more lines in the meantime */
+        g_hash_table_iter_init(&iter, fold.shards);
+        while (g_hash_table_iter_next(&iter, (gpointer*)&name, (gpointer*)&shard)) {
+            known = g_hash_table_lookup(hi->shards, name);
+            if (known && known->state.size == shard->state.size) {
+                count++;
+            }
+        }
+        if (hi->state.inode == read.inode && hi->state.size == read.size
+            && count == g_hash_table_size(hi->shards)
+            && count == g_hash_table_size(fold.shards)
+        ) {
+            /* the index holds now exactly the items of the file */
+            g_hash_table_remove_all(hi->shards);
+            hi->state = fold.state;
+            hi->lines = fold.items->length;
+        } else {
+            /* the index is rebuilt without the folded shards */
+            index_clear(hi);
+            memset(&hi->state, 0, sizeof(UtilFileState));
+        }
+    }
+    index_clear(&fold);
+    g_queue_free(fold.items);
+    g_hash_table_destroy(fold.lookup);
+    g_hash_table_destroy(fold.shards);
+
+    return done;
 }
 
 /**
- * Checks if the given array of tags are all found in history item.
+ * Checks if the given array of tags are all found in the URI or title of a
+ * history item.
  */
-static gboolean history_item_contains_all_tags(History *item, char **query,
-    unsigned int qlen)
+static gboolean contains_all_tags(const char *first, const char *second,
+    char **query, unsigned int qlen)
 {
     unsigned int i;
     if (!qlen) {
@@ -246,8 +1269,8 @@ static gboolean history_item_contains_all_tags(History *item, char **query,
 
     /* iterate over all query parts */
     for (i = 0; i < qlen; i++) {
-        if (!(util_strcasestr(item->first, query[i])
-            || (item->second && util_strcasestr(item->second, query[i])))
+        if (!(util_strcasestr(first, query[i])
+            || (second && util_strcasestr(second, query[i])))
         ) {
             return false;
         }
@@ -256,6 +1279,99 @@ static gboolean history_item_contains_all_tags(History *item, char **query,
     return true;
 }
 
+/**
+ * Calculates the frecency rank of an URI. The weight of the visits is halved
+ * every HISTORY_FRECENCY_HALFLIFE days after the last visit. Because this
+ * decay is the same for all items at any time, the rank is calculated in
+ * relation to a fixed point in time and must not be recalculated if the time
+ * goes by.
+ *
+ * Returns the base 2 logarithm of the weighted visits.
+ */
+static double frecency(guint visits, gint64 lastvisit)
+{
+    guint exp = 0;
+
+    /* integer part of log2(visits) and linear approximation of the rest */
+    for (guint v = visits; v > 1; v >>= 1) {
+        exp++;
+    }
+
+    return exp + (double)(visits - (1u << exp)) / (1u << exp)
+        + (double)(lastvisit - FRECENCY_EPOCH) / (HISTORY_FRECENCY_HALFLIFE * 86400);
+}
+
+/**
+ * Adds an item to the min heap of the best ranked items. If the heap is
+ * already full, the worst item is replaced if the new one is better.
+ */
+static void rank_push(GPtrArray *heap, History *item)
+{
+    guint i, child;
+
+    if (heap->len < HISTORY_COMPLETION_MAX) {
+        /* sift the new item up from the last position */
+        g_ptr_array_add(heap, item);
+        for (i = heap->len - 1; i > 0 && rank_cmp(item, heap->pdata[(i - 1) / 2]) < 0; i = (i - 1) / 2) {
+            heap->pdata[i] = heap->pdata[(i - 1) / 2];
+        }
+        heap->pdata[i] = item;
+        return;
+    }
+    if (rank_cmp(item, heap->pdata[0]) <= 0) {
+        return;
+    }
+    /* replace the worst item and sift the new item down */
+    for (i = 0; (child = 2 * i + 1) < heap->len; i = child) {
+        if (child + 1 < heap->len && rank_cmp(heap->pdata[child + 1], heap->pdata[child]) < 0) {
+            child++;
+        }
+        if (rank_cmp(item, heap->pdata[child]) <= 0) {
+            break;
+        }
+        heap->pdata[i] = heap->pdata[child];
+    }
+    heap->pdata[i] = item;
+}
+
+/**
+ * Compares the rank of two items. On equal rank the latest added item is
+ * the better one.
+ */
+static int rank_cmp(History *a, History *b)
+{
+    if (a->rank != b->rank) {
+        return a->rank < b->rank ? -1 : 1;
+    }
+    return a->id < b->id ? -1 : (a->id > b->id);
+}
+
+static int rank_cmp_desc(gconstpointer a, gconstpointer b)
+{
+    return rank_cmp(*(History**)b, *(History**)a);
+}
+
+/**
+ * Writes the items of the heap sorted by rank to the completion store and
+ * frees the heap.
+ */
+static void query_ranked(CompletionQuery *query, GPtrArray *heap)
+{
+    History *item;
+
+    g_ptr_array_sort(heap, rank_cmp_desc);
+    for (guint i = 0; i < heap->len; i++) {
+        item = heap->pdata[i];
+        completion_query_add(query, item->first, item->second, item->second);
+    }
+    g_ptr_array_free(heap, true);
+}
+
+static gboolean match_tags(const char *first, const char *data, char **query)
+{
+    return contains_all_tags(first, data, query, g_strv_length(query));
+}
+
 static History *line_to_history(const char *uri, const char *title)
 {
     History *item = g_slice_new0(History);
@@ -20,6 +20,8 @@
 #ifndef _HISTORY_H
 #define _HISTORY_H
 
+#include "completion.h"
+
 typedef enum {
     HISTORY_FIRST   = 0,
     HISTORY_COMMAND = 0,
@@ -28,9 +30,13 @@ typedef enum {
     HISTORY_LAST
 } HistoryType;
 
+void history_init(void);
 void history_cleanup(void);
 void history_add(HistoryType type, const char *value, const char *additional);
-gboolean history_fill_completion(GtkListStore *store, HistoryType type, const char *input);
+void history_flush(void);
+void history_query_completion(CompletionQuery *query, const char *input,
+    gpointer data);
+gboolean history_narrow_completion(GtkListStore *store, const char *input);
 GList *history_get_list(VbInputType type, const char *query);
 
 #endif /* end of include guard: _HISTORY_H */
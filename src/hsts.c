@@ -23,39 +23,92 @@
 #include "util.h"
 #include "main.h"
 #include <string.h>
+#include <time.h>
 #include <glib-object.h>
 #include <libsoup/soup.h>
+#ifdef TESTLIB
+/* the tests need known hosts, but the shipped list may be empty */
+#include "hsts-preload-test.h"
+#else
+#include "hsts-preload.h"
+#endif
 
 #define HSTS_HEADER_NAME "Strict-Transport-Security"
 #define HSTS_FILE_FORMAT "%s\t%s\t%c\n"
+/* prefix of the lines that remove the entry of the following host */
+#define HSTS_TOMBSTONE '-'
+/* the hsts file is compacted if it has that many times more lines than valid
+ * entries but not before it has COMPACT_MIN_LINES lines */
+#define COMPACT_RATIO 2
+#define COMPACT_MIN_LINES 100
+/* seconds between the checks if the hsts file needs compaction */
+#define COMPACT_INTERVAL 600
+/* an unchanged header of a host is processed again after half of its
+ * max-age but at the latest after that many seconds */
+#define HEADER_RENEW_INTERVAL 3600
+/* maximum number of hosts with remembered headers */
+#define HEADER_CACHE_SIZE 256
 #define HSTS_PROVIDER_GET_PRIVATE(o)  (G_TYPE_INSTANCE_GET_PRIVATE((o), HSTS_TYPE_PROVIDER, HSTSProviderPrivate))
 
 extern VbCore vb;
 
-/* private interface of the provider */
-typedef struct _HSTSProviderPrivate {
-    GHashTable* whitelist;
-} HSTSProviderPrivate;
-
 typedef struct {
-    SoupDate *expires_at;
+    time_t   expires_at;
     gboolean include_sub_domains;
 } HSTSEntry;
 
+/* The known hosts are kept in a trie of their labels from right to left, so
+ * that a host and all its superdomains are found in one walk without
+ * building the strings of the superdomains. */
+typedef struct _HSTSNode {
+    char      *label;       /* lower cased label of the node */
+    gsize     len;
+    HSTSEntry *entry;       /* entry of the host ending here or NULL */
+    GArray    *children;    /* child nodes sorted by their labels or NULL */
+} HSTSNode;
+
+/* the last processed hsts header of a host */
+typedef struct {
+    char   *value;
+    time_t renew_at;    /* the header is processed again after this time */
+} HSTSHeader;
+
+/* private interface of the provider, the hsts file is a journal of new
+ * entries and tombstones that is replayed into the whitelist */
+typedef struct _HSTSProviderPrivate {
+    HSTSNode      *whitelist;
+    GHashTable    *headers;     /* maps hosts to their last HSTSHeader */
+    UtilFileState state;        /* the part of the file replayed */
+    guint         lines;        /* lines in the file including outdated ones */
+    guint         compact_id;   /* timeout to check for compaction */
+    gboolean      compacting;   /* the file is compacted in a worker thread */
+} HSTSProviderPrivate;
+/* guards the whitelist against the compaction running in a worker thread */
+G_LOCK_DEFINE_STATIC(hsts);
+
 static void hsts_provider_class_init(HSTSProviderClass *klass);
 static void hsts_provider_init(HSTSProvider *self);
 static void hsts_provider_finalize(GObject* obj);
-static inline gboolean should_secure_host(HSTSProvider *provider,
-    const char *host);
+static gboolean is_ascii(const char *str);
+static gboolean preload_lookup(const char *host, gsize len,
+    gboolean *include_sub_domains);
+static void preload_hash(const char *host, gsize len, guint32 hash[3]);
 static void process_hsts_header(SoupMessage *msg, gpointer data);
-static void parse_hsts_header(HSTSProvider *provider,
+static int parse_hsts_header(HSTSProvider *provider,
     const char *host, const char *header);
+static void free_header(HSTSHeader *header);
 static void free_entry(HSTSEntry *entry);
+static void free_node(HSTSNode *node);
+static HSTSNode *get_node(HSTSNode *node, const char *label, gsize len,
+    gboolean create);
+static int compare_label(const HSTSNode *node, const char *label, gsize len);
 static void add_host_entry(HSTSProvider *provider, const char *host,
     HSTSEntry *entry);
 static void add_host_entry_to_file(HSTSProvider *provider, const char *host,
     HSTSEntry *entry);
-static void remove_host_entry(HSTSProvider *provider, const char *host);
+static gboolean remove_host_entry(HSTSProvider *provider, const char *host);
+static HSTSNode *get_host_node(HSTSProvider *provider, const char *host,
+    gboolean create);
 /* session feature related functions */
 static void session_feature_init(
     SoupSessionFeatureInterface *inteface, gpointer data);
@@ -66,8 +119,16 @@ static void request_started(SoupSessionFeature *feature,
 static void request_unqueued(SoupSessionFeature *feature,
     SoupSession *session, SoupMessage *msg);
 /* caching related functions */
-static void load_entries(HSTSProvider *provider, const char *file);
-static void save_entries(HSTSProvider *provider, const char *file);
+static void load_entries(HSTSProvider *provider);
+static void parse_entries(HSTSProvider *provider, char *content);
+static guint sweep_node(HSTSNode *node, time_t now);
+static void save_node(GString *content, HSTSNode *node, GString *host);
+static gboolean compact_timeout(HSTSProvider *provider);
+static void compact_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable);
+static void compact_finished(HSTSProvider *provider, GAsyncResult *result,
+    gpointer data);
+static void compact(HSTSProvider *provider);
 
 /**
  * Change scheme and port of soup messages uri if the host is a known and
@@ -103,7 +164,7 @@ char *hsts_get_changed_uri(SoupSession* session, SoupMessage *msg)
     provider = HSTS_PROVIDER(feature);
     /* if URI uses still https we don't nee to rewrite it */
     if (uri->scheme != SOUP_URI_SCHEME_HTTPS
-        && should_secure_host(provider, uri->host)
+        && hsts_should_secure_host(provider, uri->host)
     ) {
         /* the ports is set by soup uri if scheme is changed */
         soup_uri_set_scheme(uri, SOUP_URI_SCHEME_HTTPS);
@@ -138,95 +199,218 @@ static void hsts_provider_init(HSTSProvider *self)
 {
     /* initialize private fields */
     HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(self);
-    priv->whitelist = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_entry);
+    priv->whitelist = g_slice_new0(HSTSNode);
+    priv->headers   = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, (GDestroyNotify)free_header
+    );
 
     /* load entries from hsts file */
-    load_entries(self, vb.files[FILES_HSTS]);
+    G_LOCK(hsts);
+    load_entries(self);
+    G_UNLOCK(hsts);
+
+    /* the entries of other instances are read and the outdated ones are
+     * dropped from time to time */
+    priv->compact_id = g_timeout_add_seconds(
+        COMPACT_INTERVAL, (GSourceFunc)compact_timeout, self
+    );
 }
 
 static void hsts_provider_finalize(GObject* obj)
 {
     HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE (obj);
 
-    /* save all the entries in hsts file */
-    save_entries(HSTS_PROVIDER(obj), vb.files[FILES_HSTS]);
+    if (priv->compact_id) {
+        g_source_remove(priv->compact_id);
+    }
+    /* a running compaction holds a reference, so there is none at this point */
+    compact(HSTS_PROVIDER(obj));
 
-    g_hash_table_destroy(priv->whitelist);
+    free_node(priv->whitelist);
+    g_hash_table_destroy(priv->headers);
     G_OBJECT_CLASS(hsts_provider_parent_class)->finalize(obj);
 }
 
 /**
  * Checks if given host is a known https host according to RFC 6797 8.2f
  */
-static inline gboolean should_secure_host(HSTSProvider *provider,
-    const char *host)
+gboolean hsts_should_secure_host(HSTSProvider *provider, const char *host)
 {
     HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
-    HSTSEntry *entry;
-    char *canonical, *p;
-    gboolean result = false, is_subdomain = false;
+    HSTSNode *node;
+    const char *start, *end, *last;
+    char *canonical = NULL;
+    gboolean result = false, include_sub_domains;
+    time_t now;
 
     /* ip is not allowed for hsts */
     if (g_hostname_is_ip_address(host)) {
         return false;
     }
 
-    canonical = g_hostname_to_ascii(host);
-    /* don't match empty host */
-    if (*canonical) {
-        p = canonical;
-        /* Try to find the whole congruent matching host in hash table - if
-         * not found strip of the first label and try to find a superdomain
-         * match. Specified is a from right to left comparison 8.3, but in the
-         * end this should be lead to the same result. */
-        while (p != NULL) {
-            entry = g_hash_table_lookup(priv->whitelist, p);
-            if (entry != NULL) {
-                /* remove expired entries RFC 6797 8.1.1 */
-                if (soup_date_is_past(entry->expires_at)) {
-                    remove_host_entry(provider, p);
-                } else if(!is_subdomain || entry->include_sub_domains) {
-                    result = true;
-                    break;
-                }
-            }
+    /* only hosts with non ascii chars need the idna conversion, for all
+     * others the labels are compared ignoring the case */
+    if (!is_ascii(host)) {
+        canonical = g_hostname_to_ascii(host);
+        if (!canonical) {
+            return false;
+        }
+        host = canonical;
+    }
 
-            is_subdomain = true;
-            /* test without the first domain part */
-            if ((p = strchr(p, '.'))) {
-                p++;
-            }
+    /* Walk the host from right to left label by label, so the superdomains
+     * are tested before the whole host RFC 6797 8.3. Expired entries are
+     * ignored here and dropped by the compaction. */
+    G_LOCK(hsts);
+    node = priv->whitelist;
+    now  = time(NULL);
+    last = end = host + strlen(host);
+    /* don't match empty host */
+    while (end > host) {
+        for (start = end; start > host && start[-1] != '.'; start--) {
+            ;
+        }
+        if (node) {
+            node = get_node(node, start, end - start, false);
+        }
+        if (node && node->entry && node->entry->expires_at > now
+            && (start == host || node->entry->include_sub_domains)
+        ) {
+            result = true;
+            break;
+        }
+        /* hosts of the preload list are secured even on first visit */
+        if (preload_lookup(start, last - start, &include_sub_domains)
+            && (start == host || include_sub_domains)
+        ) {
+            result = true;
+            break;
+        }
+        if (start == host) {
+            break;
         }
+        end = start - 1;
     }
+    G_UNLOCK(hsts);
     g_free(canonical);
 
     return result;
 }
 
+static gboolean is_ascii(const char *str)
+{
+    for (; *str; str++) {
+        if ((guchar)*str & 0x80) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Looks up the host of given length in the HSTS preload list compiled in
+ * from hsts-preload.txt. This does not allocate any memory.
+ *
+ * Returns true if the host is found, in this case include_sub_domains is set
+ * to the flag of the host.
+ */
+static gboolean preload_lookup(const char *host, gsize len,
+    gboolean *include_sub_domains)
+{
+    guint32 hash[3], slot;
+    gint32 seed;
+    const char *entry;
+
+    preload_hash(host, len, hash);
+    /* the seed of the bucket maps its hosts to their slots, a negative seed
+     * gives the slot of the single host directly */
+    seed = hsts_preload_seeds[hash[0] % HSTS_PRELOAD_BUCKETS];
+    if (seed < 0) {
+        slot = -seed - 1;
+    } else {
+        slot = (hash[1] % HSTS_PRELOAD_SIZE
+            + (guint64)(seed / HSTS_PRELOAD_SIZE) * (hash[2] % HSTS_PRELOAD_SIZE)
+            + seed % HSTS_PRELOAD_SIZE) % HSTS_PRELOAD_SIZE;
+    }
+
+    entry = hsts_preload_hosts + (hsts_preload_slots[slot] >> 1);
+    if (g_ascii_strncasecmp(entry, host, len) || entry[len]) {
+        return false;
+    }
+    *include_sub_domains = hsts_preload_slots[slot] & 1;
+
+    return true;
+}
+
+/**
+ * Calculates the three hashes of the lower cased host used for the bucket
+ * and the slot. These must be the same as calculated by preload2h.sh.
+ */
+static void preload_hash(const char *host, gsize len, guint32 hash[3])
+{
+    guchar c;
+
+    hash[0] = hash[1] = hash[2] = 5381 + HSTS_PRELOAD_SALT;
+    for (gsize i = 0; i < len; i++) {
+        c       = g_ascii_tolower(host[i]);
+        hash[0] = hash[0] * 31 + c;
+        hash[1] = hash[1] * 33 + c;
+        hash[2] = hash[2] * 37 + c;
+    }
+}
+
 static void process_hsts_header(SoupMessage *msg, gpointer data)
 {
-    HSTSProvider *provider = (HSTSProvider*)data;
-    SoupURI *uri           = soup_message_get_uri(msg);
-    SoupMessageHeaders *hdrs;
+    HSTSProvider *provider    = (HSTSProvider*)data;
+    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    SoupURI *uri              = soup_message_get_uri(msg);
+    HSTSHeader *last;
     const char *header;
+    time_t now;
+    int max_age;
 
-    if (!g_hostname_is_ip_address(uri->host)
-        && (soup_message_get_flags(msg) & SOUP_MESSAGE_CERTIFICATE_TRUSTED)
-    ){
-        g_object_get(G_OBJECT(msg), SOUP_MESSAGE_RESPONSE_HEADERS, &hdrs, NULL);
+    if (!(soup_message_get_flags(msg) & SOUP_MESSAGE_CERTIFICATE_TRUSTED)) {
+        return;
+    }
+
+    /* TODO according to RFC 6797 8.1 we must only use the first header */
+    header = soup_message_headers_get_one(msg->response_headers, HSTS_HEADER_NAME);
+    if (!header) {
+        return;
+    }
 
-        /* TODO according to RFC 6797 8.1 we must only use the first header */
-        header = soup_message_headers_get_one(hdrs, HSTS_HEADER_NAME);
-        if (header) {
-            parse_hsts_header(provider, uri->host, header);
+    /* most sites send the same header with each response, which would only
+     * push the expiry a little further */
+    now  = time(NULL);
+    last = g_hash_table_lookup(priv->headers, uri->host);
+    if (last && last->renew_at > now && !strcmp(last->value, header)) {
+        return;
+    }
+
+    max_age = parse_hsts_header(provider, uri->host, header);
+
+    if (!last) {
+        if (g_hash_table_size(priv->headers) >= HEADER_CACHE_SIZE) {
+            g_hash_table_remove_all(priv->headers);
         }
+        last = g_slice_new(HSTSHeader);
+        g_hash_table_insert(priv->headers, g_strdup(uri->host), last);
+    } else {
+        g_free(last->value);
     }
+    last->value    = g_strdup(header);
+    /* invalid headers and removals are not processed again for a while */
+    last->renew_at = now
+        + (max_age > 0 ? MIN(max_age / 2, HEADER_RENEW_INTERVAL) : HEADER_RENEW_INTERVAL);
 }
 
 /**
  * Parses the hsts directives from given header like specified in RFC 6797 6.1
+ *
+ * Returns the max-age of the header or -1 if the header is invalid.
  */
-static void parse_hsts_header(HSTSProvider *provider,
+static int parse_hsts_header(HSTSProvider *provider,
     const char *host, const char *header)
 {
     GHashTable *directives = soup_header_parse_semi_param_list(header);
@@ -254,7 +438,7 @@ static void parse_hsts_header(HSTSProvider *provider,
                 success = false;
                 break;
             }
-        } else if (g_ascii_strncasecmp(key, "includeSubDomains", 17)) {
+        } else if (!g_ascii_strcasecmp(key, "includeSubDomains")) {
             /* includeSubDomains must not have a value */
             if (!value) {
                 include_sub_domains = true;
@@ -268,26 +452,112 @@ static void parse_hsts_header(HSTSProvider *provider,
     g_type_class_unref(klass);
 
     if (success) {
+        G_LOCK(hsts);
         /* remove host if max-age = 0 RFC 6797 6.1.1 */
         if (max_age == 0) {
-            remove_host_entry(provider, host);
+            if (remove_host_entry(provider, host)) {
+                util_file_append(vb.files[FILES_HSTS], "%c%s\n", HSTS_TOMBSTONE, host);
+            }
         } else {
             entry = g_slice_new(HSTSEntry);
-            entry->expires_at          = soup_date_new_from_now(max_age);
+            entry->expires_at          = time(NULL) + max_age;
             entry->include_sub_domains = include_sub_domains;
 
             add_host_entry(provider, host, entry);
             add_host_entry_to_file(provider, host, entry);
         }
+        G_UNLOCK(hsts);
+
+        return max_age;
     }
+
+    return -1;
+}
+
+static void free_header(HSTSHeader *header)
+{
+    g_free(header->value);
+    g_slice_free(HSTSHeader, header);
 }
 
 static void free_entry(HSTSEntry *entry)
 {
-    soup_date_free(entry->expires_at);
     g_slice_free(HSTSEntry, entry);
 }
 
+static void free_node(HSTSNode *node)
+{
+    if (node->children) {
+        for (guint i = 0; i < node->children->len; i++) {
+            free_node(g_array_index(node->children, HSTSNode*, i));
+        }
+        g_array_free(node->children, true);
+    }
+    if (node->entry) {
+        free_entry(node->entry);
+    }
+    g_free(node->label);
+    g_slice_free(HSTSNode, node);
+}
+
+/**
+ * Finds the child node of given label. If create is true and the child does
+ * not exist, it is created.
+ *
+ * Returns the child node or NULL if it does not exist and was not created.
+ */
+static HSTSNode *get_node(HSTSNode *node, const char *label, gsize len,
+    gboolean create)
+{
+    HSTSNode *child;
+    guint lo = 0, hi = node->children ? node->children->len : 0, mid;
+    int cmp;
+
+    /* binary search in the sorted children */
+    while (lo < hi) {
+        mid   = (lo + hi) / 2;
+        child = g_array_index(node->children, HSTSNode*, mid);
+        cmp   = compare_label(child, label, len);
+        if (!cmp) {
+            return child;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    child        = g_slice_new0(HSTSNode);
+    child->label = g_ascii_strdown(label, len);
+    child->len   = len;
+    if (!node->children) {
+        node->children = g_array_new(false, false, sizeof(HSTSNode*));
+    }
+    g_array_insert_val(node->children, lo, child);
+
+    return child;
+}
+
+/**
+ * Compares the label of the node with given label ignoring the case.
+ */
+static int compare_label(const HSTSNode *node, const char *label, gsize len)
+{
+    int diff;
+
+    for (gsize i = 0; i < node->len && i < len; i++) {
+        if ((diff = (guchar)node->label[i] - (guchar)g_ascii_tolower(label[i]))) {
+            return diff;
+        }
+    }
+
+    return node->len < len ? -1 : node->len > len;
+}
+
 /**
  * Adds the host to the known host, if it already exists it replaces it with
  * the information contained in entry according to RFC 6797 8.1.
@@ -295,31 +565,82 @@ static void free_entry(HSTSEntry *entry)
 static void add_host_entry(HSTSProvider *provider, const char *host,
     HSTSEntry *entry)
 {
-    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
-    g_hash_table_replace(priv->whitelist, g_hostname_to_unicode(host), entry);
+    HSTSNode *node = get_host_node(provider, host, true);
+
+    if (!node) {
+        free_entry(entry);
+        return;
+    }
+    if (node->entry) {
+        free_entry(node->entry);
+    }
+    node->entry = entry;
 }
 
 static void add_host_entry_to_file(HSTSProvider *provider, const char *host,
     HSTSEntry *entry)
 {
-    char *date = soup_date_to_string(entry->expires_at, SOUP_DATE_ISO8601_FULL);
+    SoupDate *expires = soup_date_new_from_time_t(entry->expires_at);
+    char *date        = soup_date_to_string(expires, SOUP_DATE_ISO8601_FULL);
 
     util_file_append(
         vb.files[FILES_HSTS], HSTS_FILE_FORMAT, host, date, entry->include_sub_domains ? 'y' : 'n'
     );
     g_free(date);
+    soup_date_free(expires);
 }
 
 /**
  * Removes stored entry for given host.
+ *
+ * Returns true if there was an entry for the host.
  */
-static void remove_host_entry(HSTSProvider *provider, const char *host)
+static gboolean remove_host_entry(HSTSProvider *provider, const char *host)
+{
+    HSTSNode *node = get_host_node(provider, host, false);
+
+    if (!node || !node->entry) {
+        return false;
+    }
+    free_entry(node->entry);
+    node->entry = NULL;
+
+    return true;
+}
+
+/**
+ * Walks the labels of the host from right to left through the trie of the
+ * known hosts.
+ *
+ * Returns the node of the host or NULL if it does not exist and should not be
+ * created.
+ */
+static HSTSNode *get_host_node(HSTSProvider *provider, const char *host,
+    gboolean create)
 {
     HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
-    char *canonical           = g_hostname_to_unicode(host);
+    HSTSNode *node            = priv->whitelist;
+    char *canonical           = g_hostname_to_ascii(host);
+    const char *start, *end;
 
-    g_hash_table_remove(priv->whitelist, canonical);
+    if (!canonical || !*canonical) {
+        g_free(canonical);
+        return NULL;
+    }
+    end = canonical + strlen(canonical);
+    while (node) {
+        for (start = end; start > canonical && start[-1] != '.'; start--) {
+            ;
+        }
+        node = get_node(node, start, end - start, create);
+        if (start == canonical) {
+            break;
+        }
+        end = start - 1;
+    }
     g_free(canonical);
+
+    return node;
 }
 
 /**
@@ -342,16 +663,22 @@ static void request_queued(SoupSessionFeature *feature,
     SoupURI *uri = soup_message_get_uri(msg);
     HSTSProvider *provider = HSTS_PROVIDER(feature);
 
-    /* only look for HSTS headers sent over https RFC 6797 7.2*/
-    if (uri->scheme == SOUP_URI_SCHEME_HTTPS) {
-        soup_message_add_header_handler(
-            msg, "got-headers", HSTS_HEADER_NAME, G_CALLBACK(process_hsts_header), feature
-        );
-    } else if (should_secure_host(provider, uri->host)) {
+    if (uri->scheme != SOUP_URI_SCHEME_HTTPS
+        && hsts_should_secure_host(provider, uri->host)
+    ) {
         /* the ports is set by soup uri if scheme is changed */
         soup_uri_set_scheme(uri, SOUP_URI_SCHEME_HTTPS);
         soup_session_requeue_message(session, msg);
     }
+
+    /* Only look for HSTS headers sent over https RFC 6797 7.2 and not for ip
+     * addresses RFC 6797 8.1.1. The certificate is checked when the headers
+     * are received, because it is not known before. */
+    if (uri->scheme == SOUP_URI_SCHEME_HTTPS && !g_hostname_is_ip_address(uri->host)) {
+        soup_message_add_header_handler(
+            msg, "got-headers", HSTS_HEADER_NAME, G_CALLBACK(process_hsts_header), feature
+        );
+    }
 }
 
 static void request_started(SoupSessionFeature *feature,
@@ -362,7 +689,7 @@ static void request_started(SoupSessionFeature *feature,
     GTlsCertificate *certificate;
     GTlsCertificateFlags errors;
 
-    if (should_secure_host(provider, uri->host)) {
+    if (hsts_should_secure_host(provider, uri->host)) {
         if (uri->scheme != SOUP_URI_SCHEME_HTTPS
             || (soup_message_get_https_status(msg, &certificate, &errors) && errors)
         ) {
@@ -379,78 +706,209 @@ static void request_unqueued(SoupSessionFeature *feature,
 }
 
 /**
- * Reads the entries save in given file and store them in the whitelist.
+ * Replays the lines appended to the hsts file since the last call into the
+ * whitelist. The caller must hold the hsts lock.
  */
-static void load_entries(HSTSProvider *provider, const char *file)
+static void load_entries(HSTSProvider *provider)
 {
-    char **lines, **parts, *host, *line;
-    int i, len, partlen;
-    gboolean include_sub_domains;
+    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    UtilFileChange change;
+    char *content;
+
+    content = util_file_read_new(vb.files[FILES_HSTS], &priv->state, &change);
+    if (change == UTIL_FILE_REPLACED) {
+        free_node(priv->whitelist);
+        priv->whitelist = g_slice_new0(HSTSNode);
+        priv->lines     = 0;
+    }
+    if (content) {
+        parse_entries(provider, content);
+        g_free(content);
+    }
+}
+
+static void parse_entries(HSTSProvider *provider, char *content)
+{
+    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    char *line, *next, *tab1, *tab2;
     SoupDate *date;
     HSTSEntry *entry;
 
-    lines = util_get_lines(file);
-    if (!(len = g_strv_length(lines))) {
-        return;
-    }
-
-    for (i = len - 1; i >= 0; i--) {
-        line = lines[i];
+    for (line = content; line && *line; line = next) {
+        if ((next = strchr(line, '\n'))) {
+            *next++ = '\0';
+        }
         /* skip empty or commented lines */
         if (!*line || *line == '#') {
             continue;
         }
+        priv->lines++;
 
-        parts   = g_strsplit(line, "\t", 3);
-        partlen = g_strv_length(parts);
-        if (partlen == 3) {
-            host = parts[0];
-            if (g_hostname_is_ip_address(host)) {
-                continue;
-            }
-            date = soup_date_new_from_string(parts[1]);
-            if (!date) {
-                continue;
-            }
-            include_sub_domains = (*parts[2] == 'y') ? true : false;
+        if (*line == HSTS_TOMBSTONE) {
+            remove_host_entry(provider, line + 1);
+            continue;
+        }
+        if (!(tab1 = strchr(line, '\t')) || !(tab2 = strchr(tab1 + 1, '\t'))) {
+            g_warning("could not parse hsts line '%s'", line);
+            continue;
+        }
+        *tab1++ = '\0';
+        *tab2++ = '\0';
+        if (g_hostname_is_ip_address(line)) {
+            continue;
+        }
+        date = soup_date_new_from_string(tab1);
+        if (!date) {
+            continue;
+        }
 
-            /* built the new entry to add */
-            entry = g_slice_new(HSTSEntry);
-            entry->expires_at          = soup_date_new_from_string(parts[1]);
-            entry->include_sub_domains = include_sub_domains;
+        /* built the new entry to add */
+        entry = g_slice_new(HSTSEntry);
+        entry->expires_at          = soup_date_to_time_t(date);
+        entry->include_sub_domains = *tab2 == 'y';
+        soup_date_free(date);
 
-            add_host_entry(provider, host, entry);
-        } else {
-            g_warning("could not parse hsts line '%s'", line);
+        add_host_entry(provider, line, entry);
+    }
+}
+
+/**
+ * Drops the expired entries and the nodes without entries of the children
+ * of given node.
+ *
+ * Returns the number of the remaining entries.
+ */
+static guint sweep_node(HSTSNode *node, time_t now)
+{
+    HSTSNode *child;
+    guint count = 0;
+
+    if (node->entry && node->entry->expires_at <= now) {
+        free_entry(node->entry);
+        node->entry = NULL;
+    }
+    if (node->entry) {
+        count++;
+    }
+    if (!node->children) {
+        return count;
+    }
+    for (guint i = node->children->len; i > 0; i--) {
+        child  = g_array_index(node->children, HSTSNode*, i - 1);
+        count += sweep_node(child, now);
+        if (!child->entry && !child->children) {
+            free_node(child);
+            g_array_remove_index(node->children, i - 1);
         }
-        g_strfreev(parts);
     }
-    g_strfreev(lines);
+    if (!node->children->len) {
+        g_array_free(node->children, true);
+        node->children = NULL;
+    }
+
+    return count;
 }
 
 /**
- * Saves all entries of given provider in given file.
+ * Writes the entries of the child nodes of given node into content. The host
+ * holds the labels of the node and is used to built the hosts of the
+ * children.
  */
-static void save_entries(HSTSProvider *provider, const char *file)
+static void save_node(GString *content, HSTSNode *node, GString *host)
 {
-    GHashTableIter iter;
-    char *host, *date;
-    HSTSEntry *entry;
-    FILE *f;
-    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    HSTSNode *child;
+    SoupDate *expires;
+    char *date;
+    gsize len = host->len;
 
-    if ((f = fopen(file, "w"))) {
-        FLOCK(fileno(f), F_WRLCK);
+    if (!node->children) {
+        return;
+    }
+    for (guint i = 0; i < node->children->len; i++) {
+        child = g_array_index(node->children, HSTSNode*, i);
+        if (len) {
+            g_string_prepend_c(host, '.');
+        }
+        g_string_prepend_len(host, child->label, child->len);
 
-        g_hash_table_iter_init(&iter, priv->whitelist);
-        while (g_hash_table_iter_next (&iter, (gpointer)&host, (gpointer)&entry)) {
-            date = soup_date_to_string(entry->expires_at, SOUP_DATE_ISO8601_FULL);
-            fprintf(f, HSTS_FILE_FORMAT, host, date, entry->include_sub_domains ? 'y' : 'n');
+        if (child->entry) {
+            expires = soup_date_new_from_time_t(child->entry->expires_at);
+            date    = soup_date_to_string(expires, SOUP_DATE_ISO8601_FULL);
+            g_string_append_printf(content, HSTS_FILE_FORMAT, host->str, date,
+                child->entry->include_sub_domains ? 'y' : 'n');
             g_free(date);
+            soup_date_free(expires);
         }
+        save_node(content, child, host);
+
+        g_string_erase(host, 0, host->len - len);
+    }
+}
+
+static gboolean compact_timeout(HSTSProvider *provider)
+{
+    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    GTask *task;
+
+    if (!priv->compacting) {
+        priv->compacting = true;
+        /* the task holds a reference of the provider until it is finished */
+        task = g_task_new(provider, NULL, (GAsyncReadyCallback)compact_finished, NULL);
+        g_task_run_in_thread(task, compact_thread);
+        g_object_unref(task);
+    }
+
+    return true;
+}
+
+static void compact_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable)
+{
+    compact(HSTS_PROVIDER(source));
+
+    g_task_return_boolean(task, true);
+}
+
+static void compact_finished(HSTSProvider *provider, GAsyncResult *result,
+    gpointer data)
+{
+    HSTS_PROVIDER_GET_PRIVATE(provider)->compacting = false;
+}
 
-        FLOCK(fileno(f), F_UNLCK);
-        fclose(f);
+/**
+ * Replays the entries added by other instances and replaces the hsts file by
+ * a file with only the valid entries, if it holds too many expired or
+ * superseded entries and tombstones.
+ */
+static void compact(HSTSProvider *provider)
+{
+    HSTSProviderPrivate *priv = HSTS_PROVIDER_GET_PRIVATE(provider);
+    UtilFileState state;
+    GString *content, *host;
+    guint count;
+
+    G_LOCK(hsts);
+    load_entries(provider);
+    count = sweep_node(priv->whitelist, time(NULL));
+    if (priv->lines < COMPACT_MIN_LINES || priv->lines <= count * COMPACT_RATIO) {
+        G_UNLOCK(hsts);
+        return;
+    }
+    content = g_string_sized_new(priv->state.size);
+    host    = g_string_sized_new(64);
+    save_node(content, priv->whitelist, host);
+    g_string_free(host, true);
+    state = priv->state;
+    G_UNLOCK(hsts);
+
+    /* The file is written without the lock to not block the lookups. If an
+     * entry was appended in the meantime, the file is not replaced. */
+    if (util_file_replace(vb.files[FILES_HSTS], content->str, content->len, &state)) {
+        G_LOCK(hsts);
+        priv->state = state;
+        priv->lines = count;
+        G_UNLOCK(hsts);
     }
+    g_string_free(content, true);
 }
 #endif
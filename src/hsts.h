@@ -47,6 +47,7 @@ typedef struct {
 char *hsts_get_changed_uri(SoupSession* session, SoupMessage *msg);
 GType hsts_provider_get_type(void);
 HSTSProvider *hsts_provider_new(void);
+gboolean hsts_should_secure_host(HSTSProvider *provider, const char *host);
 
 #endif /* end of include guard: _HSTS_H */
 #endif
@@ -43,6 +43,7 @@
 #include "autocmd.h"
 #include "arh.h"
 #include "io.h"
+#include "store.h"
 #include "ascii.h"
 
 /* variables */
@@ -580,6 +581,8 @@ void vb_quit(gboolean force)
     if (vb.state.uri) {
         g_file_set_contents(vb.files[FILES_CLOSED], vb.state.uri, -1, NULL);
     }
+    /* write the buffered history entries */
+    history_flush();
 
     gtk_main_quit();
 }
@@ -1036,6 +1039,13 @@ static void init_core(void)
 
     read_config();
 
+#ifdef FEATURE_SHARED_STORE
+    /* find out if another instance holds the history and bookmarks */
+    store_init();
+#endif
+    /* build the history index after the config set the max history size */
+    history_init();
+
     /* initially apply input style */
     vb_update_input_style();
 
@@ -1084,24 +1094,30 @@ static void marks_clear(void)
 
 static void read_config(void)
 {
-    char *line, **lines;
+    const char *line;
+    gsize len;
+    UtilLines lines;
+    GString *cmd;
 
     /* read config from config files */
-    lines = util_get_lines(vb.files[FILES_CONFIG]);
-
-    if (lines) {
-        int length = g_strv_length(lines) - 1;
-        for (int i = 0; i < length; i++) {
-            line = lines[i];
-            if (*line == '#') {
-                continue;
-            }
-            if (ex_run_string(line, false) & VB_CMD_ERROR ) {
-                g_warning("Invalid user config: '%s'", line);
-            }
+    if (!util_lines_open(&lines, vb.files[FILES_CONFIG])) {
+        return;
+    }
+
+    cmd = g_string_sized_new(128);
+    while (util_lines_next(&lines, &line, &len)) {
+        if (len && *line == '#') {
+            continue;
+        }
+        /* the mapped line is not NUL terminated */
+        g_string_truncate(cmd, 0);
+        g_string_append_len(cmd, line, len);
+        if (ex_run_string(cmd->str, false) & VB_CMD_ERROR ) {
+            g_warning("Invalid user config: '%s'", cmd->str);
         }
     }
-    g_strfreev(lines);
+    g_string_free(cmd, true);
+    util_lines_close(&lines);
 }
 
 static void setup_signals()
@@ -1686,12 +1702,7 @@ static void read_from_stdin(void)
 #ifdef FEATURE_ARH
 static void session_request_queued_cb(SoupSession *session, SoupMessage *msg, gpointer data)
 {
-    SoupURI *suri = soup_message_get_uri(msg);
-    char     *uri = soup_uri_to_string(suri, false);
-
-    arh_run(vb.config.autoresponseheader, uri, msg);
-
-    g_free(uri);
+    arh_run(vb.config.autoresponseheader, msg);
 }
 #endif
 
@@ -1706,6 +1717,10 @@ static void vb_cleanup(void)
     cleanup_modes();
     setting_cleanup();
     history_cleanup();
+    bookmark_cleanup();
+#ifdef FEATURE_SHARED_STORE
+    store_cleanup();
+#endif
     session_cleanup();
     register_cleanup();
 #ifdef FEATURE_AUTOCMD
@@ -35,6 +35,9 @@
 #ifdef FEATURE_HSTS
 #include "hsts.h"
 #endif
+#ifdef FEATURE_ARH
+#include "arh.h"
+#endif
 
 /* size of some I/O buffer */
 #define BUF_SIZE  512
@@ -329,7 +332,7 @@ typedef struct {
     gboolean     strict_focus;
     GHashTable   *headers;        /* holds user defined header appended to requests */
 #ifdef FEATURE_ARH
-    GSList       *autoresponseheader; /* holds user defined list of auto-response-header */
+    ARH          *autoresponseheader; /* holds user defined auto-response-header rules */
 #endif
     char         *nextpattern;    /* regex patter nfor prev link matching */
     char         *prevpattern;    /* regex patter nfor next link matching */
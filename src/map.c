@@ -35,9 +35,19 @@ typedef struct {
     gboolean remap;     /* if false do not remap the {rhs} of this map */
 } Map;
 
+/* Node of the prefix tree of the mapped key sequences. The nodes of the first
+ * level hold the modes, so that each mode has its own tree of keys. */
+typedef struct _MapNode MapNode;
+struct _MapNode {
+    char    key;
+    Map     *map;       /* map whose {lhs} ends at this node or NULL */
+    MapNode *child;     /* first node for the following key */
+    MapNode *next;      /* next node for another key at the same position */
+};
+
 /* this is only to keep the variables together */
 static struct {
-    GSList  *list;
+    MapNode *tree;                      /* first node of the modes */
     GString *queue;                     /* queue holding typed keys */
     int     qlen;                       /* pointer to last char in queue */
     int     resolved;                   /* number of resolved keys (no mapping required) */
@@ -55,7 +65,10 @@ static int utf_char2bytes(guint c, guchar *buf);
 static char *convert_keys(const char *in, int inlen, int *len);
 static char *convert_keylabel(const char *in, int inlen, int *len);
 static gboolean do_timeout(gpointer data);
+static MapNode *get_node(MapNode **link, char key, gboolean create);
+static gboolean remove_node(MapNode **link, char key, const char *keys, int len);
 static void free_map(Map *map);
+static void free_tree(MapNode *node);
 
 static struct {
     guint state;
@@ -119,9 +132,8 @@ void map_init(void)
 
 void map_cleanup(void)
 {
-    if (map.list) {
-        g_slist_free_full(map.list, (GDestroyNotify)free_map);
-    }
+    free_tree(map.tree);
+    map.tree = NULL;
     g_string_free(map.queue, true);
 }
 
@@ -184,7 +196,7 @@ gboolean map_keypress(GtkWidget *widget, GdkEventKey* event, gpointer data)
  */
 MapState map_handle_keys(const guchar *keys, int keylen, gboolean use_map)
 {
-    int ambiguous;
+    MapNode *node;
     Map *match = NULL;
     gboolean timeout = (keylen == 0); /* keylen 0 signalized timeout */
     static int showlen = 0;           /* track the number of keys in showcmd of status bar */
@@ -256,43 +268,33 @@ MapState map_handle_keys(const guchar *keys, int keylen, gboolean use_map)
         }
 
         /* try to find matching maps */
-        match     = NULL;
-        ambiguous = 0;
+        match = NULL;
         if (use_map && !(vb.mode->flags & FLAG_NOMAP)) {
-            for (GSList *l = map.list; l != NULL; l = l->next) {
-                Map *m = (Map*)l->data;
-                /* ignore maps for other modes */
-                if (m->mode != vb.mode->id) {
-                    continue;
+            /* walk the tree of the current mode along the queued keys - the
+             * last map on the way is the longest complete match */
+            node = get_node(&map.tree, vb.mode->id, false);
+            for (int i = 0; node; i++) {
+                if (node->map) {
+                    match = node->map;
                 }
-
-                /* find ambiguous matches */
-                if (!timeout && m->inlen > map.qlen && !strncmp(m->in, map.queue->str, map.qlen)) {
-                    if (ambiguous == 0) {
-                        /* show command chars for the ambiguous commands */
-                        int i = map.qlen > SHOWCMD_LEN ? map.qlen - SHOWCMD_LEN : 0;
-                        /* appen only those chars that are not already in showcmd */
-                        i += showlen;
-                        while (i < map.qlen) {
-                            showcmd(map.queue->str[i++]);
-                            showlen++;
-                        }
-                    }
-                    ambiguous++;
-                }
-                /* complete match or better/longer match than previous found */
-                if (m->inlen <= map.qlen
-                    && !strncmp(m->in, map.queue->str, m->inlen)
-                    && (!match || match->inlen < m->inlen)
-                ) {
-                    /* backup this found possible match */
-                    match = m;
+                if (i == map.qlen) {
+                    break;
                 }
+                node = get_node(&node->child, map.queue->str[i], false);
             }
 
-            /* if there are ambiguous matches return MAP_KEY and flush queue
-             * after a timeout if the user do not type more keys */
-            if (ambiguous) {
+            /* if there are maps with more keys than queued, the queue is
+             * ambiguous - return MAP_KEY and flush queue after a timeout if
+             * the user do not type more keys */
+            if (!timeout && node && node->child) {
+                /* show command chars for the ambiguous commands */
+                int i = map.qlen > SHOWCMD_LEN ? map.qlen - SHOWCMD_LEN : 0;
+                /* appen only those chars that are not already in showcmd */
+                i += showlen;
+                while (i < map.qlen) {
+                    showcmd(map.queue->str[i++]);
+                    showlen++;
+                }
                 return MAP_AMBIGUOUS;
             }
         }
@@ -356,11 +358,18 @@ void map_handle_string(const char *str, gboolean use_map)
 void map_insert(const char *in, const char *mapped, char mode, gboolean remap)
 {
     int inlen, mappedlen;
+    MapNode *node;
     char *lhs = convert_keys(in, strlen(in), &inlen);
     char *rhs = convert_keys(mapped, strlen(mapped), &mappedlen);
 
+    node = get_node(&map.tree, mode, true);
+    for (int i = 0; i < inlen; i++) {
+        node = get_node(&node->child, lhs[i], true);
+    }
     /* if lhs was already mapped, remove this first */
-    map_delete_by_lhs(lhs, inlen, mode);
+    if (node->map) {
+        free_map(node->map);
+    }
 
     Map *new = g_slice_new(Map);
     new->in        = lhs;
@@ -370,7 +379,7 @@ void map_insert(const char *in, const char *mapped, char mode, gboolean remap)
     new->mode      = mode;
     new->remap     = remap;
 
-    map.list = g_slist_prepend(map.list, new);
+    node->map = new;
 }
 
 gboolean map_delete(const char *in, char mode)
@@ -433,18 +442,57 @@ static char *transchar(int c)
 
 static gboolean map_delete_by_lhs(const char *lhs, int len, char mode)
 {
-    for (GSList *l = map.list; l != NULL; l = l->next) {
-        Map *m = (Map*)l->data;
-
-        /* remove only if the map's lhs matches the given key sequence */
-        if (m->mode == mode && m->inlen == len && !strcmp(m->in, lhs)) {
-            /* remove the found list item */
-            map.list = g_slist_delete_link(map.list, l);
-            free_map(m);
-            return true;
+    return remove_node(&map.tree, mode, lhs, len);
+}
+
+/**
+ * Get the node for given key from the nodes starting at link. If there is no
+ * such node and create is true, a new one is appended.
+ */
+static MapNode *get_node(MapNode **link, char key, gboolean create)
+{
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->key == key) {
+            return *link;
         }
     }
-    return false;
+    if (create) {
+        *link        = g_slice_new0(MapNode);
+        (*link)->key = key;
+    }
+
+    return *link;
+}
+
+/**
+ * Removes the map for the key followed by the len keys from the tree starting
+ * at link. Nodes that lead to no other map are removed too, so that a node
+ * with children always has a map below it.
+ */
+static gboolean remove_node(MapNode **link, char key, const char *keys, int len)
+{
+    MapNode *node;
+    gboolean removed = false;
+
+    for (; *link && (*link)->key != key; link = &(*link)->next);
+    if (!(node = *link)) {
+        return false;
+    }
+
+    if (len > 0) {
+        removed = remove_node(&node->child, *keys, keys + 1, len - 1);
+    } else if (node->map) {
+        free_map(node->map);
+        node->map = NULL;
+        removed   = true;
+    }
+
+    if (!node->map && !node->child) {
+        *link = node->next;
+        g_slice_free(MapNode, node);
+    }
+
+    return removed;
 }
 
 /**
@@ -664,3 +712,17 @@ static void free_map(Map *map)
     g_free(map->mapped);
     g_slice_free(Map, map);
 }
+
+static void free_tree(MapNode *node)
+{
+    MapNode *next;
+
+    for (; node; node = next) {
+        next = node->next;
+        free_tree(node->child);
+        if (node->map) {
+            free_map(node->map);
+        }
+        g_slice_free(MapNode, node);
+    }
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Converts the HSTS preload list of chromium read from stdin into the format
+# of hsts-preload.txt. The list is the file
+# net/http/transport_security_state_static.json of the chromium sources.
+#
+# Only the entries with mode "force-https" are taken, entries that only pin
+# keys don't require https. Each entry is written to its own line followed by
+# 'y' if include_subdomains is set.
+
+printf "# HSTS preload list compiled into vimb by preload2h.sh.\n"
+printf "# generated by preload-import.sh, do not edit\n"
+
+# the list contains comment lines, that are no valid json
+sed -e 's,^[[:space:]]*//.*,,' | LC_ALL=C awk '
+BEGIN {
+    RS = "}"
+}
+
+/"mode"[[:space:]]*:[[:space:]]*"force-https"/ {
+    if (!match($0, /"name"[[:space:]]*:[[:space:]]*"[^"]*"/)) {
+        next
+    }
+    host = substr($0, RSTART, RLENGTH)
+    sub(/^"name"[[:space:]]*:[[:space:]]*"/, "", host)
+    sub(/"$/, "", host)
+    if (/"include_subdomains"[[:space:]]*:[[:space:]]*true/) {
+        print host " y"
+    } else {
+        print host
+    }
+}
+'
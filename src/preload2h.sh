@@ -0,0 +1,154 @@
+#!/bin/sh
+#
+# Compiles the HSTS preload list read from stdin into a C header with a
+# minimal perfect hash of the hosts. Each line of the list holds a host
+# optionally followed by 'y' if the subdomains are included.
+#
+# The hosts are distributed into buckets of about two hosts by the first of
+# three hashes. For each bucket a seed d is searched, so that all its hosts
+# get a free slot (h1 + d / size * h2 + d % size) % size. Buckets with only
+# one host get a free slot directly, this is stored as negative seed. If the
+# hosts can't be placed, everything is tried again with another salt of the
+# hashes. The hashes must be the same as in preload_hash() of hsts.c.
+
+LC_ALL=C awk '
+function hash(s, salt,    i, c) {
+    h0 = h1 = h2 = 5381 + salt
+    for (i = 1; i <= length(s); i++) {
+        c  = ord[substr(s, i, 1)]
+        h0 = (h0 * 31 + c) % 4294967296
+        h1 = (h1 * 33 + c) % 4294967296
+        h2 = (h2 * 37 + c) % 4294967296
+    }
+}
+
+function slotof(i, seed) {
+    return (f1[i] + int(seed / n) * f2[i] + seed % n) % n
+}
+
+function place(salt,    i, b, s, j, t, seed, ok, free) {
+    split("", size)
+    split("", members)
+    split("", slot)
+    split("", seeds)
+    split("", taken)
+    max = 0
+    for (i = 0; i < n; i++) {
+        hash(hosts[i], salt)
+        f1[i] = h1 % n
+        f2[i] = h2 % n
+        b = h0 % buckets
+        members[b, size[b]++] = i
+        if (size[b] > max) {
+            max = size[b]
+        }
+    }
+
+    # place the large buckets first while there are many free slots
+    for (s = max; s > 1; s--) {
+        for (b = 0; b < buckets; b++) {
+            if (size[b] != s) {
+                continue
+            }
+            # the seeds shift all hosts of the bucket together before the
+            # second hash is used, so that every slot can be reached
+            for (seed = 0; seed < 2147483647; seed++) {
+                ok = 1
+                for (j = 0; j < s && ok; j++) {
+                    t = slotof(members[b, j], seed)
+                    if ((t in slot) || taken[t] == seed + 1) {
+                        ok = 0
+                    }
+                    taken[t] = seed + 1
+                }
+                if (ok) {
+                    break
+                }
+            }
+            if (!ok) {
+                return 0
+            }
+            for (j = 0; j < s; j++) {
+                slot[slotof(members[b, j], seed)] = members[b, j]
+            }
+            seeds[b] = seed
+        }
+    }
+    free = 0
+    for (b = 0; b < buckets; b++) {
+        if (size[b] != 1) {
+            continue
+        }
+        while (free in slot) {
+            free++
+        }
+        slot[free] = members[b, 0]
+        seeds[b]   = -free - 1
+    }
+
+    return 1
+}
+
+BEGIN {
+    for (i = 0; i < 256; i++) {
+        ord[sprintf("%c", i)] = i
+    }
+    n = 0
+}
+
+{
+    sub(/#.*/, "")
+    if (!NF) {
+        next
+    }
+    host = tolower($1)
+    sub(/\.$/, "", host)
+    if (host in known) {
+        next
+    }
+    known[host] = 1
+    hosts[n] = host
+    subs[n]  = ($2 == "y")
+    n++
+}
+
+END {
+    buckets = int((n + 1) / 2)
+    if (!buckets) {
+        buckets = 1
+    }
+    salt = 0
+    while (!place(salt)) {
+        salt++
+    }
+
+    # an empty list gets a slot with an empty host that never matches
+    printf("/* generated by preload2h.sh, do not edit */\n")
+    printf("#define HSTS_PRELOAD_SIZE %d\n", n ? n : 1)
+    printf("#define HSTS_PRELOAD_BUCKETS %d\n", buckets)
+    printf("#define HSTS_PRELOAD_SALT %d\n\n", salt)
+
+    printf("static const char hsts_preload_hosts[] =")
+    offset = 0
+    for (t = 0; t < n; t++) {
+        printf("\n    \"%s\\000\"", hosts[slot[t]])
+        offsets[t] = offset
+        offset += length(hosts[slot[t]]) + 1
+    }
+    printf("%s;\n\n", n ? "" : " \"\"")
+
+    printf("/* offset of the host of each slot shifted left by one and the flag for\n")
+    printf(" * the included subdomains */\n")
+    printf("static const guint32 hsts_preload_slots[] = {")
+    for (t = 0; t < n; t++) {
+        printf("%s%d,", t % 8 ? " " : "\n    ", offsets[t] * 2 + subs[slot[t]])
+    }
+    printf("%s\n};\n\n", n ? "" : "\n    0")
+
+    printf("static const gint32 hsts_preload_seeds[] = {")
+    for (b = 0; b < buckets; b++) {
+        printf("%s%d,", b % 8 ? " " : "\n    ", seeds[b])
+    }
+    printf("\n};\n")
+}
+'
@@ -830,7 +830,7 @@ static int autoresponseheader(const char *name, int type, void *value, void *dat
 {
     const char *error = NULL;
 
-    GSList *new = arh_parse((char *)value, &error);
+    ARH *new = arh_parse((char *)value, &error);
 
     if (! error) {
         /* remove previous parsed headers */
@@ -0,0 +1,417 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "config.h"
+#ifdef FEATURE_SHARED_STORE
+#include "store.h"
+#include "main.h"
+#include "history.h"
+#include "bookmark.h"
+#include "completion.h"
+#include "util.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+
+extern VbCore vb;
+
+/* number of bytes of an answer collected before they are sent */
+#define STORE_WRITE_SIZE 4096
+/* seconds to wait for the other side of the store socket */
+#define STORE_TIMEOUT 2
+
+/* An answer is written as lines of the tab separated item fields, followed by
+ * an empty line. */
+typedef struct {
+    int     fd;
+    GString *out;
+} StoreAnswer;
+
+static gboolean store_listen(void);
+static void store_takeover(void);
+static int store_connect(void);
+static void store_set_timeout(int sock);
+static gboolean store_accept(GIOChannel *chan);
+static void store_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable);
+static gboolean store_write(const char *first, const char *second,
+    const char *data, StoreAnswer *answer);
+static gboolean store_send(int fd, const char *buf, gsize len);
+
+/* The first instance listens on the store socket and answers the completion
+ * queries of the instances started later from its indices. So only one of
+ * them has to load the history and bookmarks. The instance holding the store
+ * holds the lock file too, so that another instance can take the store over
+ * once it quit. */
+static struct {
+    char     *path;         /* path of the store socket */
+    int      lock;          /* the lock file, locked by the server */
+    gboolean server;        /* this instance answers the queries */
+    gboolean client;        /* the queries are answered by another instance */
+} store = {NULL, -1};
+/* guards the store against the queries running in worker threads */
+G_LOCK_DEFINE_STATIC(store);
+
+
+/**
+ * Connects to the instance that holds the shared store or becomes this
+ * instance if there is none.
+ */
+void store_init(void)
+{
+    struct sockaddr_un local;
+    char *dir, *name, *lockfile;
+
+    /* instances using other files must not share their data */
+    dir  = g_build_filename(g_get_user_runtime_dir(), PROJECT, NULL);
+    util_create_dir_if_not_exists(dir);
+    name = g_strdup_printf("store-%08x", g_str_hash(vb.files[FILES_HISTORY]));
+    store.path = g_build_filename(dir, name, NULL);
+    g_free(dir);
+    g_free(name);
+
+    if (strlen(store.path) >= sizeof(local.sun_path)) {
+        g_warning("Store socket path too long %s", store.path);
+        return;
+    }
+    lockfile   = g_strconcat(store.path, ".lock", NULL);
+    store.lock = open(lockfile, O_RDWR|O_CREAT, 0600);
+    g_free(lockfile);
+    if (store.lock == -1) {
+        g_warning("Can't open store lock %s", store.path);
+        return;
+    }
+
+    G_LOCK(store);
+    if (flock(store.lock, LOCK_EX|LOCK_NB) == -1) {
+        /* another instance holds the store */
+        store.client = true;
+    } else {
+        store_listen();
+    }
+    G_UNLOCK(store);
+}
+
+void store_cleanup(void)
+{
+    G_LOCK(store);
+    if (store.server && unlink(store.path) == -1) {
+        g_warning("Can't remove store socket %s", store.path);
+    }
+    /* closing the lock file lets another instance take the store over */
+    if (store.lock != -1) {
+        close(store.lock);
+        store.lock = -1;
+    }
+    g_free(store.path);
+    store.path   = NULL;
+    store.server = false;
+    store.client = false;
+    G_UNLOCK(store);
+}
+
+/**
+ * Indicates if the completion queries are answered by another instance.
+ */
+gboolean store_is_client(void)
+{
+    gboolean client;
+
+    G_LOCK(store);
+    client = store.client;
+    G_UNLOCK(store);
+
+    return client;
+}
+
+/**
+ * Asks the instance holding the shared store for the completion items of
+ * given provider and adds them to the query. This is run in a worker thread.
+ *
+ * Returns false if the query could not be answered by the store, so that the
+ * caller has to answer it on its own.
+ */
+gboolean store_query(CompletionQuery *query, StoreProvider provider, int arg,
+    const char *input)
+{
+    GIOChannel *chan;
+    char *request, *line, *second, *data;
+    gsize term;
+    int sock;
+    gboolean done = false, added = false;
+
+    if (!store_is_client()) {
+        return false;
+    }
+    if ((sock = store_connect()) == -1) {
+        store_takeover();
+        return false;
+    }
+
+    request = g_strdup_printf("%d\t%d\t%s\n", provider, arg, input ? input : "");
+    if (!store_send(sock, request, strlen(request))) {
+        g_free(request);
+        close(sock);
+        store_takeover();
+
+        return false;
+    }
+    g_free(request);
+
+    chan = g_io_channel_unix_new(sock);
+    g_io_channel_set_encoding(chan, NULL, NULL);
+    g_io_channel_set_close_on_unref(chan, true);
+    while (!completion_query_cancelled(query)
+        && g_io_channel_read_line(chan, &line, NULL, &term, NULL) == G_IO_STATUS_NORMAL
+    ) {
+        line[term] = '\0';
+        /* the empty line marks the end of the answer */
+        if (!*line) {
+            g_free(line);
+            done = true;
+            break;
+        }
+        if ((second = strchr(line, '\t'))) {
+            *second++ = '\0';
+            if ((data = strchr(second, '\t'))) {
+                *data++ = '\0';
+            }
+            completion_query_add(
+                query, line, *second ? second : NULL, data && *data ? data : NULL
+            );
+            added = true;
+        }
+        g_free(line);
+    }
+    /* closing the socket stops the answer of a cancelled query */
+    g_io_channel_unref(chan);
+
+    /* the other instance quit or did not answer in time */
+    if (!done && !completion_query_cancelled(query)) {
+        store_takeover();
+    }
+
+    /* if there is no answer at all, answer it on our own */
+    return done || added || completion_query_cancelled(query);
+}
+
+/**
+ * Listens on the store socket to answer the queries of other instances. The
+ * caller must hold the store lock and the lock file.
+ */
+static gboolean store_listen(void)
+{
+    struct sockaddr_un local;
+    GIOChannel *chan;
+    int sock;
+
+    /* no instance holds the lock, so the socket file is a leftover */
+    unlink(store.path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        g_warning("Can't create store socket %s", store.path);
+        flock(store.lock, LOCK_UN);
+        return false;
+    }
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, store.path);
+
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) == -1
+        || listen(sock, 5) == -1
+    ) {
+        g_warning("Could not listen on %s: %s", store.path, strerror(errno));
+        close(sock);
+        flock(store.lock, LOCK_UN);
+        return false;
+    }
+    chan = g_io_channel_unix_new(sock);
+    g_io_channel_set_close_on_unref(chan, true);
+    g_io_add_watch(chan, G_IO_IN, (GIOFunc)store_accept, NULL);
+    g_io_channel_unref(chan);
+    store.server = true;
+
+    return true;
+}
+
+/**
+ * Called if the instance holding the store did not answer. The queries are
+ * answered by this instance from now on. If the other instance quit, this
+ * one takes the store over and answers the queries of the others too.
+ */
+static void store_takeover(void)
+{
+    G_LOCK(store);
+    if (store.client) {
+        store.client = false;
+        if (flock(store.lock, LOCK_EX|LOCK_NB) == 0) {
+            store_listen();
+        }
+    }
+    G_UNLOCK(store);
+}
+
+static int store_connect(void)
+{
+    struct sockaddr_un remote;
+    int sock;
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        return -1;
+    }
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strcpy(remote.sun_path, store.path);
+    if (connect(sock, (struct sockaddr*)&remote, sizeof(remote)) == -1) {
+        close(sock);
+        return -1;
+    }
+    store_set_timeout(sock);
+
+    return sock;
+}
+
+/**
+ * Limits the time to wait for the other side, so that a hanging instance
+ * does not block the completion of others.
+ */
+static void store_set_timeout(int sock)
+{
+    struct timeval timeout = {STORE_TIMEOUT, 0};
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static gboolean store_accept(GIOChannel *chan)
+{
+    GTask *task;
+    int sock;
+
+    if ((sock = accept(g_io_channel_unix_get_fd(chan), NULL, NULL)) != -1) {
+        store_set_timeout(sock);
+        /* the query is read and answered in a worker thread */
+        task = g_task_new(NULL, NULL, NULL, NULL);
+        g_task_set_task_data(task, GINT_TO_POINTER(sock), NULL);
+        g_task_run_in_thread(task, store_thread);
+        g_object_unref(task);
+    }
+
+    return true;
+}
+
+static void store_thread(GTask *task, gpointer source, gpointer data,
+    GCancellable *cancellable)
+{
+    StoreAnswer answer = {GPOINTER_TO_INT(data), NULL};
+    CompletionProviderFunc func = NULL;
+    GIOChannel *chan;
+    char *line, *input = NULL;
+    gsize term;
+    int provider, arg;
+
+    chan = g_io_channel_unix_new(answer.fd);
+    g_io_channel_set_encoding(chan, NULL, NULL);
+    g_io_channel_set_close_on_unref(chan, true);
+
+    /* the request is made of the provider, its argument and the input */
+    if (g_io_channel_read_line(chan, &line, NULL, &term, NULL) == G_IO_STATUS_NORMAL) {
+        line[term] = '\0';
+        if (sscanf(line, "%d\t%d\t", &provider, &arg) == 2
+            && (input = strchr(line, '\t')) && (input = strchr(input + 1, '\t'))
+        ) {
+            switch (provider) {
+                case STORE_HISTORY:
+                    if (arg >= HISTORY_FIRST && arg < HISTORY_LAST) {
+                        func = history_query_completion;
+                    }
+                    break;
+
+                case STORE_BOOKMARK:
+                    func = bookmark_query_completion;
+                    break;
+
+                case STORE_BOOKMARK_TAG:
+                    func = bookmark_query_tag_completion;
+                    break;
+            }
+        }
+        if (func) {
+            answer.out = g_string_sized_new(STORE_WRITE_SIZE);
+            completion_query_run(
+                input + 1, func, GINT_TO_POINTER(arg),
+                (CompletionSinkFunc)store_write, &answer
+            );
+            g_string_append_c(answer.out, '\n');
+            store_send(answer.fd, answer.out->str, answer.out->len);
+            g_string_free(answer.out, true);
+        }
+        g_free(line);
+    }
+    g_io_channel_unref(chan);
+
+    g_task_return_boolean(task, true);
+}
+
+/**
+ * Collects the item for the answer. Returns false to cancel the query if
+ * the asking instance does not read the answer anymore.
+ */
+static gboolean store_write(const char *first, const char *second,
+    const char *data, StoreAnswer *answer)
+{
+    g_string_append_printf(
+        answer->out, "%s\t%s\t%s\n", first, second ? second : "", data ? data : ""
+    );
+    if (answer->out->len < STORE_WRITE_SIZE) {
+        return true;
+    }
+    if (!store_send(answer->fd, answer->out->str, answer->out->len)) {
+        return false;
+    }
+    g_string_truncate(answer->out, 0);
+
+    return true;
+}
+
+static gboolean store_send(int fd, const char *buf, gsize len)
+{
+    ssize_t n;
+
+    while (len) {
+        /* don't get killed by SIGPIPE if the other side closed the socket */
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+#endif
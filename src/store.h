@@ -0,0 +1,42 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include "config.h"
+#ifdef FEATURE_SHARED_STORE
+
+#ifndef _STORE_H
+#define _STORE_H
+
+#include "completion.h"
+
+/* the completion providers that can be asked of the store */
+typedef enum {
+    STORE_HISTORY,          /* the argument is the HistoryType */
+    STORE_BOOKMARK,
+    STORE_BOOKMARK_TAG,
+} StoreProvider;
+
+void store_init(void);
+void store_cleanup(void);
+gboolean store_is_client(void);
+gboolean store_query(CompletionQuery *query, StoreProvider provider, int arg,
+    const char *input);
+
+#endif /* end of include guard: _STORE_H */
+#endif
@@ -21,6 +21,10 @@
 #include <stdio.h>
 #include <pwd.h>
 #include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include "main.h"
 #include "util.h"
 #include "ascii.h"
@@ -28,8 +32,51 @@
 
 extern VbCore vb;
 
-static gboolean match(const char *pattern, int patlen, const char *subject);
-static gboolean match_list(const char *pattern, int patlen, const char *subject);
+/* operations of the compiled wildmatch patterns */
+typedef enum {
+    WILD_CHAR,          /* char compared case insensitive */
+    WILD_BYTE,          /* char compared case sensitive */
+    WILD_ANY,           /* any char */
+    WILD_ANY_NOSLASH,   /* any char except of '/' */
+    WILD_SPLIT,         /* continue at x and at y */
+    WILD_JMP,           /* continue at x */
+    WILD_MATCH,         /* pattern list x matches if the subject ends here */
+    WILD_ACCEPT         /* pattern list x matches whatever follows */
+} WildOp;
+
+typedef struct {
+    WildOp op;
+    char   c;
+    guint  x, y;
+} WildInst;
+
+/* max number of instructions for that the state of a match is put onto the
+ * stack */
+#define WILD_STACK_MAX 1024
+
+/* The pattern list is compiled into a program for a NFA, that is simulated
+ * by following all possible paths through the program at once. So the time
+ * needed grows linear with the length of the subject. */
+
+struct _UtilWildmatch {
+    WildInst *prog;
+    guint    len;
+    guint    count;     /* number of compiled pattern lists */
+};
+
+static const char *wild_pattern_end(const char *pattern);
+static void wild_compile_patterns(GArray *prog, const char *pattern, guint tag);
+static gboolean wild_compile(GArray *prog, const char *pattern, int patlen,
+    guint tag);
+static void wild_compile_list(GArray *prog, const char *list, int len);
+static guint wild_emit(GArray *prog, WildOp op, char c, guint x, guint y);
+static gboolean wild_exec(const UtilWildmatch *matcher, const char *subject,
+    gboolean *matches);
+static void wild_add(const UtilWildmatch *matcher, guint *list, guint *count,
+    guint *marks, guint gen, guint pc);
+static int file_lock(const char *file, int flags);
+static gboolean match_prefix(const char *first, const char *data,
+    const char *input);
 
 /**
  * Retrieves newly allocated string with vimb config directory.
@@ -103,157 +150,265 @@ char *util_get_file_contents(const char *filename, gsize *length)
 }
 
 /**
- * Retrieves the file content as lines.
+ * Maps the given file into memory to iterate over its lines by
+ * util_lines_next() without copying them.
  *
- * The result have to be freed by g_strfreev().
+ * Returns false if the file could not be mapped. If true is returned the
+ * lines must be released by util_lines_close().
  */
-char **util_get_lines(const char *filename)
+gboolean util_lines_open(UtilLines *lines, const char *filename)
 {
-    char *content = util_get_file_contents(filename, NULL);
-    char **lines  = NULL;
-    if (content) {
-        /* split the file content into lines */
-        lines = g_strsplit(content, "\n", -1);
-        g_free(content);
+    GError *error = NULL;
+
+    lines->file = g_mapped_file_new(filename, false, &error);
+    if (!lines->file) {
+        g_warning("Cannot open %s: %s", filename, error->message);
+        g_error_free(error);
+
+        return false;
     }
-    return lines;
+    lines->start = g_mapped_file_get_contents(lines->file);
+    lines->end   = lines->start + g_mapped_file_get_length(lines->file);
+
+    return true;
 }
 
 /**
- * Retrieves a list with unique items from file. The uniqueness is calculated
- * based on the lines comparing all chars until the next <tab> char or end of
- * line.
+ * Retrieves the next line from the beginning of the not yet read lines. The
+ * line is not NUL terminated, its length without the newline is written to
+ * len.
  *
- * @filename:    file to read items from
- * @func:        Function to parse a single line to item.
- * @max_items:   maximum number of items that are returned, use 0 for
- *               unlimited items
+ * Returns false if there are no more lines.
  */
-GList *util_file_to_unique_list(const char *filename, Util_Content_Func func,
-    guint max_items)
+gboolean util_lines_next(UtilLines *lines, const char **line, gsize *len)
 {
-    char *line, **lines;
-    int i, len;
-    GList *gl = NULL;
-    GHashTable *ht;
+    const char *nl;
 
-    lines = util_get_lines(filename);
-    if (!lines) {
-        return NULL;
+    if (lines->start >= lines->end) {
+        return false;
+    }
+    *line = lines->start;
+    if ((nl = memchr(lines->start, '\n', lines->end - lines->start))) {
+        *len         = nl - lines->start;
+        lines->start = nl + 1;
+    } else {
+        *len         = lines->end - lines->start;
+        lines->start = lines->end;
     }
 
-    /* Use the hashtable to check for duplicates in a faster way than by
-     * iterating over the generated list itself. So it's enough to store the
-     * the keys only. */
-    ht = g_hash_table_new(g_str_hash, g_str_equal);
+    return true;
+}
 
-    /* Begin with the last line of the file to make unique check easier -
-     * every already existing item in the table is the latest, so we don't need
-     * to do anything if an item already exists in the hash table. */
-    len = g_strv_length(lines);
-    for (i = len - 1; i >= 0; i--) {
-        char *key, *data;
-        void *item;
+void util_lines_close(UtilLines *lines)
+{
+    g_mapped_file_unref(lines->file);
+    lines->file  = NULL;
+    lines->start = lines->end = NULL;
+}
 
-        line = lines[i];
-        g_strstrip(line);
-        if (!*line) {
-            continue;
+/**
+ * Reads the complete lines that were appended to file since the last call
+ * with the same state. If the file was truncated, rewritten or replaced in
+ * the meantime, the state is reset, change is set to UTIL_FILE_REPLACED and
+ * the whole file content is returned.
+ *
+ * @file:   File to read
+ * @state:  Read position of the file, must be zeroed before the first call.
+ * @change: Set to the kind of change detected for the file.
+ *
+ * Returned string must be freed. Returns NULL if there are no new lines.
+ */
+char *util_file_read_new(const char *file, UtilFileState *state,
+    UtilFileChange *change)
+{
+    struct stat st;
+    char buf[UTIL_FILE_TAIL_LEN], *content;
+    gsize len;
+    int fd;
+
+    *change = UTIL_FILE_UNCHANGED;
+    if ((fd = open(file, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
         }
-
-        /* if line contains tab char - separate the line at this */
-        if ((data = strchr(line, '\t'))) {
-            *data = '\0';
-            key   = line;
-            data++;
-        } else {
-            key  = line;
-            data = NULL;
+        /* a vanished file is handled like an emptied one */
+        if (state->size) {
+            memset(state, 0, sizeof(UtilFileState));
+            *change = UTIL_FILE_REPLACED;
         }
+        return NULL;
+    }
 
-        /* Check if the entry is already in the result list. */
-        if (g_hash_table_lookup_extended(ht, key, NULL, NULL)) {
-            continue;
+    /* The file was rewritten if it was replaced or if the last bytes we have
+     * read before have changed. */
+    if ((guint64)st.st_ino != state->inode
+        || st.st_size < state->size
+        || (state->taillen
+            && (pread(fd, buf, state->taillen, state->size - state->taillen) != state->taillen
+                || memcmp(buf, state->tail, state->taillen)))
+    ) {
+        if (state->size || state->inode) {
+            *change = UTIL_FILE_REPLACED;
         }
+        memset(state, 0, sizeof(UtilFileState));
+        state->inode = st.st_ino;
+    }
 
-        /* Item is new - prepend it to the list. Because the record are read
-         * in reverse order the prepend generates a list in the right order. */
-        if ((item = func(key, data))) {
-            g_hash_table_insert(ht, key, NULL);
-            gl = g_list_prepend(gl, item);
+    if (st.st_size == state->size) {
+        close(fd);
+        return NULL;
+    }
 
-            /* Don't put more entries into the list than requested. */
-            if (max_items && g_hash_table_size(ht) >= max_items) {
-                break;
-            }
-        }
+    len     = st.st_size - state->size;
+    content = g_malloc(len + 1);
+    if (pread(fd, content, len, state->size) != (ssize_t)len) {
+        close(fd);
+        g_free(content);
+        return NULL;
+    }
+    close(fd);
+
+    /* Consume complete lines only, a partial written line is read on the
+     * next call. */
+    while (len && content[len - 1] != '\n') {
+        len--;
     }
+    if (!len) {
+        g_free(content);
+        return NULL;
+    }
+    content[len] = '\0';
 
-    g_strfreev(lines);
-    g_hash_table_destroy(ht);
+    state->size   += len;
+    state->taillen = MIN(len, UTIL_FILE_TAIL_LEN);
+    memcpy(state->tail, content + len - state->taillen, state->taillen);
+    if (*change == UTIL_FILE_UNCHANGED) {
+        *change = UTIL_FILE_APPENDED;
+    }
 
-    return gl;
+    return content;
 }
 
 /**
- * Append new data to file.
- *
- * @file:   File to append the data
- * @format: Format string used to process va_list
+ * Sets the state to the whole content of the file opened as fd, as if it was
+ * read by util_file_read_new(). This fails if the file does not end with a
+ * complete line.
  */
-gboolean util_file_append(const char *file, const char *format, ...)
+gboolean util_file_state_init(UtilFileState *state, int fd)
 {
-    va_list args;
-    FILE *f;
+    struct stat st;
 
-    if ((f = fopen(file, "a+"))) {
-        FLOCK(fileno(f), F_WRLCK);
+    memset(state, 0, sizeof(UtilFileState));
+    if (fstat(fd, &st) == -1) {
+        return false;
+    }
+    state->inode   = st.st_ino;
+    state->size    = st.st_size;
+    state->taillen = MIN(st.st_size, UTIL_FILE_TAIL_LEN);
+    if (pread(fd, state->tail, state->taillen, st.st_size - state->taillen) != state->taillen
+        || (state->taillen && state->tail[state->taillen - 1] != '\n')
+    ) {
+        memset(state, 0, sizeof(UtilFileState));
+        return false;
+    }
 
-        va_start(args, format);
-        vfprintf(f, format, args);
-        va_end(args);
+    return true;
+}
 
-        FLOCK(fileno(f), F_UNLCK);
-        fclose(f);
+/**
+ * Replaces the content of the file known by state with given content. The
+ * content is written to a temporary file that is renamed to file, so that
+ * readers see either the old or the new file. The file is not replaced if it
+ * was changed after it was read, because these changes would be lost. The
+ * file is locked from this check until it is replaced, so that no lines can
+ * be appended in between by util_file_append().
+ *
+ * On success the state is set to the new content of the file, which gets the
+ * permissions of the replaced file.
+ */
+gboolean util_file_replace(const char *file, const char *content, gsize len,
+    UtilFileState *state)
+{
+    UtilFileState new;
+    struct stat st;
+    char *tmp;
+    int fd, lock = -1;
+    gboolean done = false;
 
-        return true;
+    tmp = g_strconcat(file, ".XXXXXX", NULL);
+    if ((fd = g_mkstemp(tmp)) == -1) {
+        g_free(tmp);
+
+        return false;
     }
-    return false;
+
+    /* the file is locked after the slow writing to keep the appenders
+     * waiting as short as possible */
+    if (write(fd, content, len) == (ssize_t)len
+        && !fsync(fd)
+        && util_file_state_init(&new, fd)
+        && (lock = file_lock(file, 0)) != -1
+        && !fstat(lock, &st)
+        && (guint64)st.st_ino == state->inode && st.st_size == state->size
+        && !fchmod(fd, st.st_mode & 07777)
+        && !rename(tmp, file)
+    ) {
+        *state = new;
+        done   = true;
+    } else {
+        unlink(tmp);
+    }
+    /* closing the replaced file releases the waiting appenders */
+    if (lock != -1) {
+        close(lock);
+    }
+    close(fd);
+    g_free(tmp);
+
+    return done;
+}
+
+/**
+ * Opens the file for appending and locks it exclusively. The file is created
+ * if it does not exist. Data written to the returned file descriptor can't
+ * get lost by a concurrent util_file_replace() of the file.
+ *
+ * Returns the file descriptor, which is unlocked by closing it, or -1 on
+ * error.
+ */
+int util_file_lock(const char *file)
+{
+    return file_lock(file, O_CREAT);
 }
 
 /**
- * Prepend new data to file.
+ * Append new data to file.
  *
- * @file:   File to prepend the data
+ * @file:   File to append the data
  * @format: Format string used to process va_list
  */
-gboolean util_file_prepend(const char *file, const char *format, ...)
+gboolean util_file_append(const char *file, const char *format, ...)
 {
-    gboolean res = false;
     va_list args;
-    char *content;
     FILE *f;
+    int fd;
 
-    content = util_get_file_contents(file, NULL);
-    if ((f = fopen(file, "w"))) {
-        FLOCK(fileno(f), F_WRLCK);
-
-        va_start(args, format);
-        /* write new content to the file */
-        vfprintf(f, format, args);
-        va_end(args);
-
-        /* append previous file content */
-        fputs(content, f);
+    if ((fd = util_file_lock(file)) == -1) {
+        return false;
+    }
+    if (!(f = fdopen(fd, "a"))) {
+        close(fd);
+        return false;
+    }
 
-        FLOCK(fileno(f), F_UNLCK);
-        fclose(f);
+    va_start(args, format);
+    vfprintf(f, format, args);
+    va_end(args);
 
-        res = true;
-    }
-    g_free(content);
+    /* closing the file flushes the data before it is unlocked */
+    fclose(f);
 
-    return res;
+    return true;
 }
 
 char *util_strcasestr(const char *haystack, const char *needle)
@@ -534,6 +689,21 @@ gboolean util_parse_expansion(const char **input, GString *str, int flags,
 
 /**
  * Compares given string against also given list of patterns.
+ * See util_wildmatch_compile() for the pattern syntax.
+ */
+gboolean util_wildmatch(const char *pattern, const char *subject)
+{
+    UtilWildmatch *matcher = util_wildmatch_compile(pattern);
+    gboolean result        = util_wildmatch_exec(matcher, subject);
+
+    util_wildmatch_free(matcher);
+
+    return result;
+}
+
+/**
+ * Compiles given comma separated list of patterns into a matcher that can be
+ * used for util_wildmatch_exec() as often as needed.
  *
  * *         Matches any sequence of characters.
  * ?         Matches any single character except of '/'.
@@ -541,196 +711,410 @@ gboolean util_parse_expansion(const char **input, GString *str, int flags,
  *           escaped by '\'. '*' and '?' have no special meaning within the
  *           curly braces.
  * *?{}      these chars must always be escaped by '\' to match them literally
+ *
+ * Returned matcher must be freed with util_wildmatch_free().
  */
-gboolean util_wildmatch(const char *pattern, const char *subject)
+UtilWildmatch *util_wildmatch_compile(const char *pattern)
+{
+    return util_wildmatch_compile_all(&pattern, 1);
+}
+
+/**
+ * Compiles several pattern lists into a single matcher, so that a subject
+ * can be matched against all of them in one pass by
+ * util_wildmatch_exec_all().
+ *
+ * Returned matcher must be freed with util_wildmatch_free().
+ */
+UtilWildmatch *util_wildmatch_compile_all(const char **patterns, guint count)
+{
+    UtilWildmatch *matcher = g_slice_new(UtilWildmatch);
+    GArray *prog           = g_array_new(false, false, sizeof(WildInst));
+
+    /* the last split of each list continues with the next list */
+    for (guint i = 0; i < count; i++) {
+        wild_compile_patterns(prog, patterns[i], i);
+    }
+
+    matcher->len   = prog->len;
+    matcher->count = count;
+    matcher->prog  = (WildInst*)g_array_free(prog, false);
+
+    return matcher;
+}
+
+/**
+ * Tests if the subject is matched by the compiled pattern list.
+ */
+gboolean util_wildmatch_exec(const UtilWildmatch *matcher, const char *subject)
+{
+    return wild_exec(matcher, subject, NULL);
+}
+
+/**
+ * Matches the subject against all pattern lists of a matcher created by
+ * util_wildmatch_compile_all(). The matches array must hold an entry for
+ * each of the pattern lists and is set to true for all lists that matched.
+ *
+ * Returns true if at least one of the lists matched.
+ */
+gboolean util_wildmatch_exec_all(const UtilWildmatch *matcher,
+    const char *subject, gboolean *matches)
+{
+    memset(matches, 0, sizeof(gboolean) * matcher->count);
+
+    return wild_exec(matcher, subject, matches);
+}
+
+/**
+ * Splits a comma separated pattern list into its single patterns. Empty
+ * patterns are left out.
+ *
+ * Returned string array must be freed with g_strfreev().
+ */
+char **util_wildmatch_split(const char *pattern)
 {
+    GPtrArray *parts = g_ptr_array_new();
     const char *end;
-    int braces, patlen, count;
+
+    for (; *pattern; pattern = (*end == ',' ? end + 1 : end)) {
+        end = wild_pattern_end(pattern);
+        if (end > pattern) {
+            g_ptr_array_add(parts, g_strndup(pattern, end - pattern));
+        }
+    }
+    g_ptr_array_add(parts, NULL);
+
+    return (char**)g_ptr_array_free(parts, false);
+}
+
+void util_wildmatch_free(UtilWildmatch *matcher)
+{
+    g_free(matcher->prog);
+    g_slice_free(UtilWildmatch, matcher);
+}
+
+/**
+ * Returns the end of the first pattern of a comma separated pattern list.
+ */
+static const char *wild_pattern_end(const char *pattern)
+{
+    const char *end;
+    int braces = 0;
+
+    /* be careful with comma in curly braces */
+    for (end = pattern; *end && (*end != ',' || braces || (end > pattern && *(end - 1) == '\\')); ++end) {
+        if (*end == '{') {
+            braces++;
+        } else if (*end == '}') {
+            braces--;
+        }
+    }
+
+    return end;
+}
+
+/**
+ * Compiles a comma separated pattern list. Each pattern is tried after the
+ * previous ones and a matching pattern ends with a match of given tag.
+ */
+static void wild_compile_patterns(GArray *prog, const char *pattern, guint tag)
+{
+    const char *end;
+    guint split;
+    int count;
 
     /* loop through all pattens */
     for (count = 0; *pattern; pattern = (*end == ',' ? end + 1 : end), count++) {
-        /* find end of the pattern - but be careful with comma in curly braces */
-        braces = 0;
-        for (end = pattern; *end && (*end != ',' || braces || *(end - 1) == '\\'); ++end) {
-            if (*end == '{') {
-                braces++;
-            } else if (*end == '}') {
-                braces--;
-            }
-        }
+        end = wild_pattern_end(pattern);
         /* ignore single comma */
         if (*pattern == *end) {
             continue;
         }
-        /* calculate the length of the pattern */
-        patlen = end - pattern;
 
-        /* if this pattern matches - return */
-        if (match(pattern, patlen, subject)) {
-            return true;
+        /* a pattern with syntax error is left out because it never matches */
+        split = wild_emit(prog, WILD_SPLIT, 0, prog->len + 1, 0);
+        if (wild_compile(prog, pattern, end - pattern, tag)) {
+            g_array_index(prog, WildInst, split).y = prog->len;
+        } else {
+            g_array_set_size(prog, split);
         }
     }
-
     if (!count) {
         /* empty pattern matches only on empty subject */
-        return !*subject;
+        wild_emit(prog, WILD_SPLIT, 0, prog->len + 1, prog->len + 2);
+        wild_emit(prog, WILD_MATCH, 0, tag, 0);
     }
-    /* there where one or more patterns but none of them matched */
-    return false;
 }
 
 /**
- * Compares given subject string against the given pattern.
- * The pattern needs not to bee NUL terminated.
+ * Compiles a single pattern of a pattern list. The pattern needs not to be
+ * NUL terminated.
+ *
+ * Returns false on a syntax error, in this case the program may hold parts
+ * of the pattern.
  */
-static gboolean match(const char *pattern, int patlen, const char *subject)
+static gboolean wild_compile(GArray *prog, const char *pattern, int patlen,
+    guint tag)
 {
-    int i;
-    char sl, pl;
+    const char *end;
+    guint loop;
+    char c;
 
-    while (patlen > 0) {
+    for (; patlen > 0; pattern++, patlen--) {
         switch (*pattern) {
             case '?':
                 /* '?' matches a single char except of / and subject end */
-                if (*subject == '/' || !*subject) {
-                    return false;
-                }
+                wild_emit(prog, WILD_ANY_NOSLASH, 0, 0, 0);
                 break;
 
             case '*':
-                /* easiest case - the '*' ist the last char in pattern - this
-                 * will always match */
+                /* multiple * act like a single one */
+                while (patlen > 1 && pattern[1] == '*') {
+                    pattern++;
+                    patlen--;
+                }
+                /* the '*' ist the last char in pattern - this will always
+                 * match */
                 if (patlen == 1) {
+                    wild_emit(prog, WILD_ACCEPT, 0, tag, 0);
                     return true;
                 }
-                /* Try to match as much as possible. Try to match the complete
-                 * uri, if that fails move forward in uri and check for a
-                 * match. */
-                i = strlen(subject);
-                while (i >= 0 && !match(pattern + 1, patlen - 1, subject + i)) {
-                    i--;
-                }
-                return i >= 0;
+                /* skip over the char or leave the loop */
+                loop = wild_emit(prog, WILD_SPLIT, 0, prog->len + 1, prog->len + 3);
+                wild_emit(prog, WILD_ANY, 0, 0, 0);
+                wild_emit(prog, WILD_JMP, 0, loop, 0);
+                break;
 
             case '}':
                 /* spurious '}' in pattern */
                 return false;
 
             case '{':
-                /* possible {foo,bar} pattern */
-                return match_list(pattern, patlen, subject);
+                /* find the next none escaped '}' */
+                for (end = pattern; end < pattern + patlen && *end != '}'; end++) {
+                    /* if escape char - move pointer one additional step */
+                    if (*end == '\\') {
+                        end++;
+                    }
+                }
+                if (end >= pattern + patlen) {
+                    /* unterminated '{' in pattern */
+                    return false;
+                }
+                wild_compile_list(prog, pattern + 1, end - pattern - 1);
+                patlen -= end - pattern;
+                pattern = end;
+                break;
 
             case '\\':
                 /* '\' escapes next special char */
-                if (strchr("*?{}", pattern[1])) {
+                if (patlen > 1 && pattern[1] && strchr("*?{}", pattern[1])) {
                     pattern++;
                     patlen--;
-                    if (*pattern != *subject) {
-                        return false;
-                    }
+                    wild_emit(prog, WILD_BYTE, *pattern, 0, 0);
+                    break;
                 }
-                break;
+                /* fall through */
 
             default:
                 /* compare case insensitive */
-                sl = *subject;
-                if (VB_IS_UPPER(sl)) {
-                    sl += 'a' - 'A';
-                }
-                pl = *pattern;
-                if (VB_IS_UPPER(pl)) {
-                    pl += 'a' - 'A';
-                }
-                if (sl != pl) {
-                    return false;
+                c = *pattern;
+                if (VB_IS_UPPER(c)) {
+                    c += 'a' - 'A';
                 }
+                wild_emit(prog, WILD_CHAR, c, 0, 0);
                 break;
         }
-        /* do another loop run with next pattern and subject char */
-        pattern++;
-        patlen--;
-        subject++;
     }
 
     /* on end of pattern only a also ended subject is a match */
-    return !*subject;
+    wild_emit(prog, WILD_MATCH, 0, tag, 0);
+
+    return true;
 }
 
 /**
- * Matches pattern starting with '{'.
- * This function can process also on none null terminated pattern.
+ * Compiles the comma separated items found between '{' and '}'. The items
+ * are compared case sensitive.
  */
-static gboolean match_list(const char *pattern, int patlen, const char *subject)
+static void wild_compile_list(GArray *prog, const char *list, int len)
 {
-    int endlen;
-    const char *end, *s;
+    GArray *jumps = g_array_new(false, false, sizeof(guint));
+    guint split, jump;
 
-    /* finde the next none escaped '}' */
-    for (end = pattern, endlen = patlen; endlen > 0 && *end != '}'; end++, endlen--) {
-        /* if escape char - move pointer one additional step */
-        if (*end == '\\') {
-            end++;
-            endlen--;
+    while (true) {
+        split = wild_emit(prog, WILD_SPLIT, 0, prog->len + 1, 0);
+        for (; len > 0 && *list != ','; list++, len--) {
+            /* '\' escapes ',', '{' and '}' and is a normal char else */
+            if (*list == '\\' && len > 1) {
+                if (!strchr(",{}", list[1])) {
+                    wild_emit(prog, WILD_BYTE, *list, 0, 0);
+                }
+                list++;
+                len--;
+            }
+            wild_emit(prog, WILD_BYTE, *list, 0, 0);
         }
+        /* continue after the list if this item matched */
+        jump = wild_emit(prog, WILD_JMP, 0, 0, 0);
+        g_array_append_val(jumps, jump);
+        g_array_index(prog, WildInst, split).y = prog->len;
+        if (len <= 0) {
+            break;
+        }
+        /* skip over the ',' */
+        list++;
+        len--;
+    }
+
+    /* the split of the last item has no further item to try */
+    g_array_index(prog, WildInst, split).op = WILD_JMP;
+    for (guint i = 0; i < jumps->len; i++) {
+        g_array_index(prog, WildInst, g_array_index(jumps, guint, i)).x = prog->len;
     }
+    g_array_free(jumps, true);
+}
+
+/**
+ * Appends an instruction to the program.
+ *
+ * Returns the position of the new instruction.
+ */
+static guint wild_emit(GArray *prog, WildOp op, char c, guint x, guint y)
+{
+    WildInst inst = {op, c, x, y};
+
+    g_array_append_val(prog, inst);
+
+    return prog->len - 1;
+}
+
+/**
+ * Runs the program on the subject. Without matches array the first match
+ * ends the run, else all pattern lists are marked that match.
+ */
+static gboolean wild_exec(const UtilWildmatch *matcher, const char *subject,
+    gboolean *matches)
+{
+    guint *clist, *nlist, *marks, *tmp, *heap = NULL, ccount = 0, ncount, gen = 1;
+    gboolean found = false;
+    WildInst *inst;
+    char c, lc;
 
-    if (!*end) {
-        /* unterminated '{' in pattern */
+    if (!matcher->len) {
         return false;
     }
 
-    s = subject;
-    end++;      /* skip over } */
-    endlen--;
-    pattern++;  /* skip over { */
-    patlen--;
-    while (true) {
-        switch (*pattern) {
-            case ',':
-                if (match(end, endlen, s)) {
-                    return true;
-                }
-                s = subject;
-                pattern++;
-                patlen--;
-                break;
+    /* the lists hold the program positions of all paths that matched the
+     * subject so far, the marks prevent to add a position twice */
+    if (matcher->len > WILD_STACK_MAX) {
+        /* the programs of many combined lists are kept off the stack */
+        clist = heap = g_new(guint, matcher->len * 3);
+    } else {
+        clist = g_newa(guint, matcher->len * 3);
+    }
+    nlist = clist + matcher->len;
+    marks = nlist + matcher->len;
+    memset(marks, 0, sizeof(guint) * matcher->len);
+
+    wild_add(matcher, clist, &ccount, marks, gen, 0);
+    for (; ccount; subject++) {
+        c  = *subject;
+        lc = VB_IS_UPPER(c) ? c + 'a' - 'A' : c;
+        ncount = 0;
+        gen++;
+        for (guint i = 0; i < ccount; i++) {
+            inst = &matcher->prog[clist[i]];
+            switch (inst->op) {
+                case WILD_ACCEPT:
+                    found = true;
+                    if (!matches) {
+                        goto done;
+                    }
+                    matches[inst->x] = true;
+                    break;
 
-            case '}':
-                return match(end, endlen, s);
+                case WILD_MATCH:
+                    if (c) {
+                        break;
+                    }
+                    found = true;
+                    if (!matches) {
+                        goto done;
+                    }
+                    matches[inst->x] = true;
+                    break;
 
-            case '\\':
-                if (pattern[1] == ',' || pattern[1] == '}' || pattern[1] == '{') {
-                    pattern++;
-                    patlen--;
-                }
-                /* fall through */
+                case WILD_CHAR:
+                    if (c && lc == inst->c) {
+                        wild_add(matcher, nlist, &ncount, marks, gen, clist[i] + 1);
+                    }
+                    break;
 
-            default:
-                if (*pattern == *s) {
-                    pattern++;
-                    patlen--;
-                    s++;
-                } else {
-                    /* this item of the list does not match - move forward to
-                     * the next none escaped ',' or '}' */
-                    s = subject;
-                    for (s = subject; *pattern != ',' && *pattern != '}'; pattern++, patlen--) {
-                        /* if escape char is found - skip next char */
-                        if (*pattern == '\\') {
-                            pattern++;
-                            patlen--;
-                        }
+                case WILD_BYTE:
+                    if (c && c == inst->c) {
+                        wild_add(matcher, nlist, &ncount, marks, gen, clist[i] + 1);
                     }
-                    /* found ',' skip over it to check the next list item */
-                    if (*pattern == ',') {
-                        pattern++;
-                        patlen--;
+                    break;
+
+                case WILD_ANY_NOSLASH:
+                    if (c == '/') {
+                        break;
                     }
-                }
+                    /* fall through */
+
+                case WILD_ANY:
+                    if (c) {
+                        wild_add(matcher, nlist, &ncount, marks, gen, clist[i] + 1);
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        if (!c) {
+            break;
         }
+        tmp    = clist;
+        clist  = nlist;
+        nlist  = tmp;
+        ccount = ncount;
     }
+
+done:
+    g_free(heap);
+
+    return found;
 }
 
+/**
+ * Adds the position to the list of positions to try for the next subject
+ * char. Jumps and splits are followed right away.
+ */
+static void wild_add(const UtilWildmatch *matcher, guint *list, guint *count,
+    guint *marks, guint gen, guint pc)
+{
+    if (pc >= matcher->len || marks[pc] == gen) {
+        return;
+    }
+    marks[pc] = gen;
+    switch (matcher->prog[pc].op) {
+        case WILD_JMP:
+            wild_add(matcher, list, count, marks, gen, matcher->prog[pc].x);
+            break;
+
+        case WILD_SPLIT:
+            wild_add(matcher, list, count, marks, gen, matcher->prog[pc].x);
+            wild_add(matcher, list, count, marks, gen, matcher->prog[pc].y);
+            break;
+
+        default:
+            list[(*count)++] = pc;
+            break;
+    }
+}
 
 /**
  * Fills the given list store by matching data of also given src list.
@@ -759,3 +1143,46 @@ gboolean util_fill_completion(GtkListStore *store, const char *input, GList *src
 
     return found;
 }
+
+/**
+ * Removes the items from the store of a previous util_fill_completion() that
+ * do not start with given input.
+ */
+gboolean util_narrow_completion(GtkListStore *store, const char *input)
+{
+    completion_narrow(store, (CompletionMatchFunc)match_prefix, (gpointer)input);
+
+    return true;
+}
+
+/**
+ * Opens given file for appending and locks it exclusively. If the file was
+ * replaced while waiting for the lock, the new file is locked instead,
+ * because data written to the old one would be lost.
+ */
+static int file_lock(const char *file, int flags)
+{
+    struct stat st, current;
+    int fd;
+
+    while ((fd = open(file, O_WRONLY|O_APPEND|flags, 0666)) != -1) {
+        if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+            close(fd);
+            return -1;
+        }
+        if (!stat(file, &current)
+            && current.st_ino == st.st_ino && current.st_dev == st.st_dev
+        ) {
+            return fd;
+        }
+        close(fd);
+    }
+
+    return -1;
+}
+
+static gboolean match_prefix(const char *first, const char *data,
+    const char *input)
+{
+    return g_str_has_prefix(first, input);
+}
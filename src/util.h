@@ -28,7 +28,32 @@ enum {
     UTIL_EXP_SPECIAL = 0x04, /* expand % to current URI */
 };
 
-typedef void *(*Util_Content_Func)(const char*, const char*);
+/* number of last read bytes kept to detect rewritten files */
+#define UTIL_FILE_TAIL_LEN 64
+
+typedef enum {
+    UTIL_FILE_UNCHANGED,
+    UTIL_FILE_APPENDED,
+    UTIL_FILE_REPLACED
+} UtilFileChange;
+
+/* Remembers which part of a file was already read. */
+typedef struct {
+    goffset size;                     /* number of bytes already read */
+    guint64 inode;
+    char    tail[UTIL_FILE_TAIL_LEN]; /* the last bytes already read */
+    int     taillen;
+} UtilFileState;
+
+/* Compiled list of patterns for util_wildmatch_exec(). */
+typedef struct _UtilWildmatch UtilWildmatch;
+
+/* Lines of a memory mapped file that are not read yet. */
+typedef struct {
+    GMappedFile *file;
+    const char  *start;
+    const char  *end;
+} UtilLines;
 
 char* util_get_config_dir(void);
 char* util_get_cache_dir(void);
@@ -36,11 +61,16 @@ const char* util_get_home_dir(void);
 void util_create_dir_if_not_exists(const char* dirpath);
 void util_create_file_if_not_exists(const char* filename);
 char* util_get_file_contents(const char* filename, gsize* length);
-char** util_get_lines(const char* filename);
-GList *util_file_to_unique_list(const char *filename, Util_Content_Func func,
-    guint max_items);
+gboolean util_lines_open(UtilLines *lines, const char *filename);
+gboolean util_lines_next(UtilLines *lines, const char **line, gsize *len);
+void util_lines_close(UtilLines *lines);
+char *util_file_read_new(const char *file, UtilFileState *state,
+    UtilFileChange *change);
+gboolean util_file_state_init(UtilFileState *state, int fd);
+gboolean util_file_replace(const char *file, const char *content, gsize len,
+    UtilFileState *state);
+int util_file_lock(const char *file);
 gboolean util_file_append(const char *file, const char *format, ...);
-gboolean util_file_prepend(const char *file, const char *format, ...);
 char* util_strcasestr(const char* haystack, const char* needle);
 char *util_str_replace(const char* search, const char* replace, const char* string);
 gboolean util_create_tmp_file(const char *content, char **file);
@@ -49,6 +79,14 @@ char *util_expand(const char *src, int expflags);
 gboolean util_parse_expansion(const char **input, GString *str, int flags,
     const char *quoteable);
 gboolean util_wildmatch(const char *pattern, const char *subject);
+UtilWildmatch *util_wildmatch_compile(const char *pattern);
+UtilWildmatch *util_wildmatch_compile_all(const char **patterns, guint count);
+gboolean util_wildmatch_exec(const UtilWildmatch *matcher, const char *subject);
+gboolean util_wildmatch_exec_all(const UtilWildmatch *matcher,
+    const char *subject, gboolean *matches);
+char **util_wildmatch_split(const char *pattern);
+void util_wildmatch_free(UtilWildmatch *matcher);
 gboolean util_fill_completion(GtkListStore *store, const char *input, GList *src);
+gboolean util_narrow_completion(GtkListStore *store, const char *input);
 
 #endif /* end of include guard: _UTIL_H */
@@ -0,0 +1,363 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include <gtk/gtk.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <src/main.h>
+#include <src/bookmark.h>
+#include <src/completion.h>
+#include <src/util.h>
+
+extern VbCore vb;
+
+static char *dir;   /* holds the files of the running test */
+
+#define ASSERT_QUERY(func, input, expected) { \
+    char *result = query(func, input);          \
+    g_assert_cmpstr(result, ==, expected);      \
+    g_free(result);                             \
+}
+
+#define ASSERT_FILE(file, expected) { \
+    char *content;                                                      \
+    g_assert_true(g_file_get_contents(file, &content, NULL, NULL));     \
+    g_assert_cmpstr(content, ==, expected);                             \
+    g_free(content);                                                    \
+}
+
+static gboolean collect(const char *first, const char *second,
+    const char *data, GString *result)
+{
+    if (result->len) {
+        g_string_append_c(result, ' ');
+    }
+    g_string_append(result, first);
+
+    return true;
+}
+
+/**
+ * Runs the completion provider and returns the space separated items in the
+ * order they are shown.
+ */
+static char *query(CompletionProviderFunc func, const char *input)
+{
+    GString *result = g_string_new("");
+
+    completion_query_run(input, func, NULL, (CompletionSinkFunc)collect, result);
+
+    return g_string_free(result, false);
+}
+
+/**
+ * Writes the bookmark and queue files with given content into a new
+ * directory.
+ */
+static void start(const char *bookmarks, const char *queue)
+{
+    dir = g_dir_make_tmp("vimb-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+
+    vb.files[FILES_BOOKMARK] = g_build_filename(dir, "bookmark", NULL);
+    g_assert_true(g_file_set_contents(vb.files[FILES_BOOKMARK], bookmarks, -1, NULL));
+#ifdef FEATURE_QUEUE
+    vb.files[FILES_QUEUE] = g_build_filename(dir, "queue", NULL);
+    g_assert_true(g_file_set_contents(vb.files[FILES_QUEUE], queue, -1, NULL));
+#endif
+}
+
+static void stop(void)
+{
+    bookmark_cleanup();
+    unlink(vb.files[FILES_BOOKMARK]);
+    g_free(vb.files[FILES_BOOKMARK]);
+#ifdef FEATURE_QUEUE
+    unlink(vb.files[FILES_QUEUE]);
+    g_free(vb.files[FILES_QUEUE]);
+#endif
+    rmdir(dir);
+    g_free(dir);
+}
+
+static void test_tombstone(void)
+{
+    start(
+        "http://a.org/\tA\tfoo\n"
+        "http://b.org/\tB\n"
+        "-http://a.org/\n"
+        "http://c.org/\n",
+        ""
+    );
+
+    /* the tombstones remove the former added bookmarks */
+    ASSERT_QUERY(bookmark_query_completion, "", "http://c.org/ http://b.org/");
+    ASSERT_QUERY(bookmark_query_completion, "foo", "");
+
+    g_assert_true(bookmark_remove("http://b.org/"));
+    g_assert_false(bookmark_remove("http://b.org/"));
+    g_assert_false(bookmark_remove("http://x.org/"));
+    ASSERT_QUERY(bookmark_query_completion, "", "http://c.org/");
+
+    /* bookmarks added again become the newest ones */
+    g_assert_true(bookmark_add("http://a.org/", "A", "bar"));
+    g_assert_true(bookmark_add("http://c.org/", "C", NULL));
+    ASSERT_QUERY(bookmark_query_completion, "", "http://c.org/ http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "bar", "http://a.org/");
+
+    /* the lines appended by other instances are replayed too */
+    g_assert_true(util_file_append(vb.files[FILES_BOOKMARK], "-http://c.org/\n"));
+    ASSERT_QUERY(bookmark_query_completion, "", "http://a.org/");
+
+    stop();
+}
+
+static void test_compact(void)
+{
+    GString *lines = g_string_new(
+        "http://a.org/\tA\tfoo bar\n"
+        "http://b.org/\n"
+        "http://c.org/\t\tbaz\n"
+    );
+
+    /* so many tombstones let the file be compacted on the next read */
+    for (int i = 0; i < 60; i++) {
+        g_string_append(lines, "http://x.org/\tX\n-http://x.org/\n");
+    }
+    start(lines->str, "");
+    g_string_free(lines, true);
+
+    ASSERT_QUERY(bookmark_query_completion, "", "http://c.org/ http://b.org/ http://a.org/");
+    ASSERT_FILE(
+        vb.files[FILES_BOOKMARK],
+        "http://a.org/\tA\tfoo bar\nhttp://b.org/\nhttp://c.org/\t\tbaz\n"
+    );
+
+    /* the compacted file holds the same bookmarks */
+    bookmark_cleanup();
+    ASSERT_QUERY(bookmark_query_completion, "", "http://c.org/ http://b.org/ http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "baz", "http://c.org/");
+    ASSERT_QUERY(bookmark_query_completion, "foo", "http://a.org/");
+
+    /* and is further appended */
+    g_assert_true(bookmark_remove("http://a.org/"));
+    ASSERT_FILE(
+        vb.files[FILES_BOOKMARK],
+        "http://a.org/\tA\tfoo bar\nhttp://b.org/\nhttp://c.org/\t\tbaz\n-http://a.org/\n"
+    );
+
+    stop();
+}
+
+static void test_tags(void)
+{
+    start(
+        "http://a.org/\tA\tnews tech\n"
+        "http://b.org/\tB\ttech linux\n"
+        "http://c.org/\tC\tnewsletter\n"
+        "http://d.org/\tD\n"
+        "http://e.org/\tE\tlinux news linux\n",
+        ""
+    );
+
+    /* the query parts match the tags by prefix */
+    ASSERT_QUERY(bookmark_query_completion, "news", "http://e.org/ http://c.org/ http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "newsl", "http://c.org/");
+    ASSERT_QUERY(bookmark_query_completion, "tech", "http://b.org/ http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "x", "");
+    /* all parts must match */
+    ASSERT_QUERY(bookmark_query_completion, "news tech", "http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "li news", "http://e.org/");
+    ASSERT_QUERY(bookmark_query_completion, "n t l", "");
+
+    ASSERT_QUERY(bookmark_query_tag_completion, "", "linux news newsletter tech");
+    ASSERT_QUERY(bookmark_query_tag_completion, "news", "news newsletter");
+    ASSERT_QUERY(bookmark_query_tag_completion, "o", "");
+
+    /* tags of removed or replaced bookmarks are not found */
+    g_assert_true(bookmark_remove("http://c.org/"));
+    g_assert_true(bookmark_add("http://b.org/", "B", "tech"));
+    ASSERT_QUERY(bookmark_query_tag_completion, "", "linux news tech");
+    ASSERT_QUERY(bookmark_query_completion, "linux", "http://e.org/");
+    ASSERT_QUERY(bookmark_query_completion, "tech", "http://b.org/ http://a.org/");
+
+    stop();
+}
+
+static void test_tags_rebuild(void)
+{
+    start("http://a.org/\tA\tkeep\n", "");
+
+    /* so many removed bookmarks let the tag index be rebuilt */
+    for (int i = 0; i < 300; i++) {
+        g_assert_true(bookmark_add("http://x.org/", "X", "gone keep"));
+        g_assert_true(bookmark_remove("http://x.org/"));
+    }
+    g_assert_true(bookmark_add("http://b.org/", "B", "keep new"));
+
+    ASSERT_QUERY(bookmark_query_tag_completion, "", "keep new");
+    ASSERT_QUERY(bookmark_query_completion, "gone", "");
+    ASSERT_QUERY(bookmark_query_completion, "keep", "http://b.org/ http://a.org/");
+    ASSERT_QUERY(bookmark_query_completion, "keep new", "http://b.org/");
+
+    stop();
+}
+
+#ifdef FEATURE_QUEUE
+#define ASSERT_POP(expected, expected_count) { \
+    int count = -1;                                 \
+    char *uri = bookmark_queue_pop(&count);         \
+    g_assert_cmpstr(uri, ==, expected);             \
+    g_assert_cmpint(count, ==, expected_count);     \
+    g_free(uri);                                    \
+}
+
+static void test_queue(void)
+{
+    struct stat st;
+    char *content;
+
+    start("", "http://1/\nhttp://2/\n+http://0/\n-\nhttp://3/\n");
+
+    /* the journal is replayed */
+    ASSERT_POP("http://1/", 2);
+
+    /* the lines appended by other instances are replayed too */
+    g_assert_true(bookmark_queue_unshift("http://9/"));
+    g_assert_true(util_file_append(vb.files[FILES_QUEUE], "http://4/\n"));
+    ASSERT_POP("http://9/", 3);
+    ASSERT_POP("http://2/", 2);
+    ASSERT_POP("http://3/", 1);
+    ASSERT_POP("http://4/", 0);
+    ASSERT_POP(NULL, 0);
+
+    /* so many pops let the file be compacted */
+    for (int i = 0; i < 60; i++) {
+        g_assert_true(bookmark_queue_push("http://x/"));
+        g_assert_true(bookmark_queue_push("http://y/"));
+        ASSERT_POP("http://x/", 1);
+        ASSERT_POP("http://y/", 0);
+    }
+    g_assert_true(g_file_get_contents(vb.files[FILES_QUEUE], &content, NULL, NULL));
+    g_assert_cmpint(strlen(content), <, 60 * 24);
+    g_assert_true(g_str_has_prefix(content, "http://x/\nhttp://y/\n-\n-\n"));
+    g_free(content);
+    /* and holds the same entries */
+    g_assert_true(bookmark_queue_push("http://5/"));
+    bookmark_cleanup();
+    ASSERT_POP("http://5/", 0);
+
+    /* the lines appended by other instances are cleared too and the file
+     * keeps its mode */
+    g_assert_true(bookmark_queue_push("http://6/"));
+    g_assert_true(util_file_append(vb.files[FILES_QUEUE], "http://7/\n"));
+    g_assert_cmpint(chmod(vb.files[FILES_QUEUE], 0640), ==, 0);
+    g_assert_true(bookmark_queue_clear());
+    g_assert_cmpint(stat(vb.files[FILES_QUEUE], &st), ==, 0);
+    g_assert_cmpint(st.st_mode & 07777, ==, 0640);
+    g_assert_cmpint(st.st_size, ==, 0);
+    ASSERT_POP(NULL, 0);
+    g_assert_true(bookmark_queue_push("http://8/"));
+    ASSERT_POP("http://8/", 0);
+
+    stop();
+}
+
+/**
+ * Pops all entries of the queue and returns them as lines.
+ */
+static char *pop_all(void)
+{
+    GString *popped = g_string_new("");
+    char *uri;
+    int count;
+
+    while ((uri = bookmark_queue_pop(&count))) {
+        g_string_append_printf(popped, "%s\n", uri);
+        g_free(uri);
+    }
+
+    return g_string_free(popped, false);
+}
+
+static void test_queue_concurrent(void)
+{
+    GString *entries = g_string_new("");
+    GHashTable *seen;
+    char *file, *popped, *other, *all, **lines;
+    int status;
+    pid_t pid;
+
+    for (int i = 0; i < 500; i++) {
+        g_string_append_printf(entries, "http://%d/\n", i);
+    }
+    start("", entries->str);
+    g_string_free(entries, true);
+
+    /* two instances pop from the same queue at once */
+    file = g_build_filename(dir, "popped", NULL);
+    if (!(pid = fork())) {
+        popped = pop_all();
+        _exit(!g_file_set_contents(file, popped, -1, NULL));
+    }
+    g_assert_cmpint(pid, >, 0);
+    popped = pop_all();
+    g_assert_cmpint(waitpid(pid, &status, 0), ==, pid);
+    g_assert_cmpint(status, ==, 0);
+    g_assert_true(g_file_get_contents(file, &other, NULL, NULL));
+    unlink(file);
+    g_free(file);
+
+    /* each entry is popped exactly once by one of the instances */
+    all   = g_strconcat(popped, other, NULL);
+    lines = g_strsplit(all, "\n", -1);
+    seen  = g_hash_table_new(g_str_hash, g_str_equal);
+    for (char **line = lines; *line; line++) {
+        if (**line) {
+            g_assert_false(g_hash_table_contains(seen, *line));
+            g_hash_table_add(seen, *line);
+        }
+    }
+    g_assert_cmpint(g_hash_table_size(seen), ==, 500);
+    g_hash_table_destroy(seen);
+    g_strfreev(lines);
+    g_free(all);
+    g_free(popped);
+    g_free(other);
+
+    stop();
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/test-bookmark/tombstone", test_tombstone);
+    g_test_add_func("/test-bookmark/compact", test_compact);
+    g_test_add_func("/test-bookmark/tags", test_tags);
+    g_test_add_func("/test-bookmark/tags-rebuild", test_tags_rebuild);
+#ifdef FEATURE_QUEUE
+    g_test_add_func("/test-bookmark/queue", test_queue);
+    g_test_add_func("/test-bookmark/queue-concurrent", test_queue_concurrent);
+#endif
+
+    return g_test_run();
+}
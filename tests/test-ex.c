@@ -0,0 +1,170 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include <gtk/gtk.h>
+#include <unistd.h>
+#include <src/main.h>
+#include <src/ex.h>
+#include <src/shortcut.h>
+#include <src/util.h>
+
+extern VbCore vb;
+
+static char *dir;   /* holds the files created by the commands */
+
+/**
+ * Returns the space separated uris of the shortcuts a, b and c, or - for the
+ * not existing ones.
+ */
+static char *get_shortcuts(void)
+{
+    const char *keys[] = {"a", "b", "c"};
+    GString *result = g_string_new("");
+    char *uri, *query;
+
+    for (guint i = 0; i < G_N_ELEMENTS(keys); i++) {
+        /* the shortcut is only used if it is followed by a query */
+        query = g_strconcat(keys[i], " query", NULL);
+        uri   = shortcut_get_uri(query);
+        g_free(query);
+        g_string_append_printf(result, "%s%s", i ? " " : "", uri ? uri : "-");
+        g_free(uri);
+        shortcut_remove(keys[i]);
+    }
+
+    return g_string_free(result, false);
+}
+
+/**
+ * Runs the input by ex_run_string() and compiled by ex_cmd_run() twice and
+ * checks that all runs give the same result and add the expected shortcuts.
+ */
+static void assert_same(const char *input, const char *expected)
+{
+    VbCmdResult res;
+    ExCmd *cmd;
+    char *shortcuts;
+
+    res       = ex_run_string(input, false);
+    shortcuts = get_shortcuts();
+    g_assert_cmpstr(shortcuts, ==, expected);
+    g_free(shortcuts);
+
+    /* the second run shows that the first did not change the compiled
+     * command, the shortcut commands split their rhs in place */
+    cmd = ex_cmd_compile(input);
+    for (int i = 0; i < 2; i++) {
+        g_assert_cmpint(ex_cmd_run(cmd), ==, res);
+        shortcuts = get_shortcuts();
+        g_assert_cmpstr(shortcuts, ==, expected);
+        g_free(shortcuts);
+    }
+    ex_cmd_free(cmd);
+}
+
+static void test_cmd_single(void)
+{
+    assert_same("shortcut-add a=http://a.org/", "http://a.org/ - -");
+    assert_same(":shortcut-add  b=http://b.org/", "- http://b.org/ -");
+}
+
+static void test_cmd_chain(void)
+{
+    assert_same(
+        "shortcut-add a=http://a.org/|shortcut-add b=http://b.org/|shortcut-add c=http://c.org/",
+        "http://a.org/ http://b.org/ http://c.org/"
+    );
+    /* a failing command stops the chain */
+    assert_same(
+        "shortcut-add a=http://a.org/|shortcut-add b|shortcut-add c=http://c.org/",
+        "http://a.org/ - -"
+    );
+}
+
+static void test_cmd_parse_error(void)
+{
+    if (g_test_subprocess()) {
+        /* the error is reported to the not existing input box */
+        g_log_set_always_fatal(G_LOG_FATAL_MASK);
+        assert_same(
+            "shortcut-add a=http://a.org/|nosuchcmd|shortcut-add b=http://b.org/",
+            "http://a.org/ - -"
+        );
+        return;
+    }
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+}
+
+/**
+ * Waits for the file created by an asynchronous shell command.
+ */
+static gboolean wait_for_file(const char *file)
+{
+    for (int i = 0; i < 100; i++) {
+        if (g_file_test(file, G_FILE_TEST_EXISTS)) {
+            return true;
+        }
+        g_usleep(G_USEC_PER_SEC / 20);
+    }
+
+    return false;
+}
+
+static void test_cmd_expand(void)
+{
+    ExCmd *cmd;
+    char *file;
+
+    /* the variable is expanded each time the command is run */
+    cmd = ex_cmd_compile("shellcmd! touch $VIMB_TEST_FILE");
+    for (int i = 0; i < 2; i++) {
+        file = g_strdup_printf("%s/file%d", dir, i);
+        g_setenv("VIMB_TEST_FILE", file, true);
+        g_assert_cmpint(ex_cmd_run(cmd), ==, VB_CMD_SUCCESS);
+        g_assert_true(wait_for_file(file));
+        unlink(file);
+        g_free(file);
+    }
+    ex_cmd_free(cmd);
+    g_unsetenv("VIMB_TEST_FILE");
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    shortcut_init();
+    dir = g_dir_make_tmp("vimb-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/test-ex/cmd/single", test_cmd_single);
+    g_test_add_func("/test-ex/cmd/chain", test_cmd_chain);
+    g_test_add_func("/test-ex/cmd/parse-error", test_cmd_parse_error);
+    g_test_add_func("/test-ex/cmd/expand", test_cmd_expand);
+    result = g_test_run();
+
+    rmdir(dir);
+    g_free(dir);
+    shortcut_cleanup();
+
+    return result;
+}
@@ -60,6 +60,24 @@ static void test_handler_run_failed(void)
     g_test_trap_assert_stderr("*Can't run *unknown-program*");
 }
 
+static void test_handler_run_changed(void)
+{
+    if (g_test_subprocess()) {
+        handler_add("http", "echo -n 'first %s'");
+        handle_uri(TEST_URI);
+        /* the changed handler must be used for the same uri */
+        handler_add("http", "echo -n 'second %s'");
+        handle_uri(TEST_URI);
+        handler_remove("http");
+        g_assert_false(handle_uri(TEST_URI));
+        return;
+    }
+    g_test_trap_subprocess(NULL, 0, 0);
+    g_test_trap_assert_passed();
+    g_test_trap_assert_stdout("*first " TEST_URI "*");
+    g_test_trap_assert_stdout("*second " TEST_URI "*");
+}
+
 int main(int argc, char *argv[])
 {
     int result;
@@ -71,6 +89,7 @@ int main(int argc, char *argv[])
     g_test_add_func("/test-handlers/remove", test_handler_remove);
     g_test_add_func("/test-handlers/handle_uri/success", test_handler_run_success);
     g_test_add_func("/test-handlers/handle_uri/failed", test_handler_run_failed);
+    g_test_add_func("/test-handlers/handle_uri/changed", test_handler_run_changed);
 
     result = g_test_run();
 
@@ -0,0 +1,411 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include <gtk/gtk.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <utime.h>
+#include <src/main.h>
+#include <src/history.h>
+#include <src/completion.h>
+#include <src/util.h>
+
+extern VbCore vb;
+
+static char *dir;   /* holds the history files of the running test */
+
+#define ASSERT_QUERY(type, input, expected) { \
+    char *result = query(type, input);          \
+    g_assert_cmpstr(result, ==, expected);      \
+    g_free(result);                             \
+}
+
+static gboolean collect(const char *first, const char *second,
+    const char *data, GString *result)
+{
+    if (result->len) {
+        g_string_append_c(result, ' ');
+    }
+    g_string_append(result, first);
+
+    return true;
+}
+
+/**
+ * Runs the completion of given history type and returns the space separated
+ * items in the order they are shown.
+ */
+static char *query(HistoryType type, const char *input)
+{
+    GString *result = g_string_new("");
+
+    completion_query_run(
+        input, history_query_completion, GINT_TO_POINTER(type),
+        (CompletionSinkFunc)collect, result
+    );
+
+    return g_string_free(result, false);
+}
+
+/**
+ * Returns the space separated items of history_get_list().
+ */
+static char *get_list(VbInputType type, const char *input)
+{
+    GList *list = history_get_list(type, input);
+    GString *result = g_string_new("");
+
+    for (GList *l = list; l; l = l->next) {
+        g_string_append_printf(result, "%s%s", result->len ? "|" : "", (char*)l->data);
+    }
+    g_list_free_full(list, g_free);
+
+    return g_string_free(result, false);
+}
+
+static void remove_dir(const char *path)
+{
+    GDir *d = g_dir_open(path, 0, NULL);
+    const char *name;
+    char *file;
+
+    while (d && (name = g_dir_read_name(d))) {
+        file = g_build_filename(path, name, NULL);
+        if (g_file_test(file, G_FILE_TEST_IS_DIR)) {
+            remove_dir(file);
+        } else {
+            unlink(file);
+        }
+        g_free(file);
+    }
+    if (d) {
+        g_dir_close(d);
+    }
+    rmdir(path);
+}
+
+/**
+ * Returns the space separated names of the files in given directory.
+ */
+static char *get_dir_list(const char *path)
+{
+    GDir *d = g_dir_open(path, 0, NULL);
+    GString *names = g_string_new("");
+    const char *name;
+
+    g_assert_nonnull(d);
+    while ((name = g_dir_read_name(d))) {
+        g_string_append_printf(names, "%s%s", names->len ? " " : "", name);
+    }
+    g_dir_close(d);
+
+    return g_string_free(names, false);
+}
+
+/**
+ * Writes the URL and command history files with given content into a new
+ * directory and reads them in.
+ */
+static void start(const char *urls, const char *commands)
+{
+    dir = g_dir_make_tmp("vimb-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+
+    vb.files[FILES_HISTORY] = g_build_filename(dir, "history", NULL);
+    vb.files[FILES_COMMAND] = g_build_filename(dir, "command", NULL);
+    vb.files[FILES_SEARCH]  = g_build_filename(dir, "search", NULL);
+    g_assert_true(g_file_set_contents(vb.files[FILES_HISTORY], urls, -1, NULL));
+    g_assert_true(g_file_set_contents(vb.files[FILES_COMMAND], commands, -1, NULL));
+    g_assert_true(g_file_set_contents(vb.files[FILES_SEARCH], "", -1, NULL));
+
+    vb.config.history_max = 100;
+    vb.state.typed        = true;
+    history_init();
+}
+
+static void stop(void)
+{
+    history_cleanup();
+    remove_dir(dir);
+    g_free(dir);
+    g_free(vb.files[FILES_HISTORY]);
+    g_free(vb.files[FILES_COMMAND]);
+    g_free(vb.files[FILES_SEARCH]);
+}
+
+static void test_index_duplicates(void)
+{
+    char *list;
+
+    start("", "open a\nopen b\nopen a\n");
+
+    /* the query is the first item followed by the unique items newest first */
+    list = get_list(VB_INPUT_COMMAND, "open");
+    g_assert_cmpstr(list, ==, "open|open a|open b");
+    g_free(list);
+    ASSERT_QUERY(HISTORY_COMMAND, "open b", "open b");
+
+    stop();
+}
+
+static void test_index_add(void)
+{
+    char *list;
+
+    start("", "open a\nopen b\n");
+
+    history_add(HISTORY_COMMAND, "open c", NULL);
+    history_add(HISTORY_COMMAND, "open a", NULL);
+    list = get_list(VB_INPUT_COMMAND, "open");
+    g_assert_cmpstr(list, ==, "open|open a|open c|open b");
+    g_free(list);
+
+    /* lines of other instances are read incrementally */
+    g_assert_true(util_file_append(vb.files[FILES_COMMAND], "open d\n"));
+    ASSERT_QUERY(HISTORY_COMMAND, "open d", "open d");
+
+    /* commands not typed by the user are not recorded */
+    vb.state.typed = false;
+    history_add(HISTORY_COMMAND, "open e", NULL);
+    ASSERT_QUERY(HISTORY_COMMAND, "open e", "");
+
+    stop();
+}
+
+static void test_index_max(void)
+{
+    start("", "open a\nopen b\nopen c\n");
+
+    /* only the newest items are kept */
+    vb.config.history_max = 2;
+    ASSERT_QUERY(HISTORY_COMMAND, "open", "open c open b");
+
+    stop();
+}
+
+static void test_trigram_query(void)
+{
+    start(
+        "http://example.org/\tExample Domain\n"
+        "http://wiki.org/news\tWiki News\n"
+        "http://foo.org/\tFoo\n"
+        "http://bar.net/\tabcd bcde\n",
+        ""
+    );
+
+    /* all tags must be found in the uri or the title ignoring the case */
+    ASSERT_QUERY(HISTORY_URL, "exa", "http://example.org/");
+    ASSERT_QUERY(HISTORY_URL, "EXAMPLE dom", "http://example.org/");
+    ASSERT_QUERY(HISTORY_URL, "wiki news", "http://wiki.org/news");
+    ASSERT_QUERY(HISTORY_URL, "news foo", "");
+    ASSERT_QUERY(HISTORY_URL, "xyz", "");
+    /* the trigrams of a tag may be found in different words */
+    ASSERT_QUERY(HISTORY_URL, "abcde", "");
+    ASSERT_QUERY(HISTORY_URL, "bcd", "http://bar.net/");
+    /* tags shorter than a trigram are matched without the index */
+    ASSERT_QUERY(HISTORY_URL, "fo", "http://foo.org/");
+    ASSERT_QUERY(HISTORY_URL, "fo org", "http://foo.org/");
+    ASSERT_QUERY(HISTORY_URL, "org", "http://foo.org/ http://wiki.org/news http://example.org/");
+
+    stop();
+}
+
+static void test_trigram_update(void)
+{
+    start("http://example.org/\tExample Domain\nhttp://foo.org/\tFoo\n", "");
+
+    /* the postings of the old title must not be found anymore */
+    history_add(HISTORY_URL, "http://example.org/", "Changed");
+    ASSERT_QUERY(HISTORY_URL, "domain", "");
+    ASSERT_QUERY(HISTORY_URL, "changed", "http://example.org/");
+    ASSERT_QUERY(HISTORY_URL, "org", "http://example.org/ http://foo.org/");
+
+    /* trimmed items are not found */
+    vb.config.history_max = 1;
+    ASSERT_QUERY(HISTORY_URL, "foo", "");
+
+    stop();
+}
+
+static void test_frecency_legacy(void)
+{
+    struct utimbuf times;
+    char *urls;
+    gint64 now = time(NULL), year = 365 * 86400;
+
+    /* lines without visits mixed with lines of older visits */
+    urls = g_strdup_printf(
+        "http://legacy.org/\tLegacy\n"
+        "http://old.org/\tOld\t1\t%" G_GINT64_FORMAT "\n"
+        "http://often.org/\tOften\t8\t%" G_GINT64_FORMAT "\n"
+        "http://nodata.org/\n",
+        now - 2 * year, now - 2 * year
+    );
+    start(urls, "");
+    g_free(urls);
+
+    /* the legacy lines count as visited when the file was last written */
+    history_cleanup();
+    times.actime = times.modtime = now - year;
+    g_assert_cmpint(utime(vb.files[FILES_HISTORY], &times), ==, 0);
+    history_init();
+
+    history_add(HISTORY_URL, "http://new.org/", "New");
+    ASSERT_QUERY(
+        HISTORY_URL, "",
+        "http://new.org/ http://nodata.org/ http://legacy.org/ http://often.org/ http://old.org/"
+    );
+    /* the rank of the legacy lines is kept after the compaction */
+    history_cleanup();
+    history_init();
+    ASSERT_QUERY(
+        HISTORY_URL, "",
+        "http://new.org/ http://nodata.org/ http://legacy.org/ http://often.org/ http://old.org/"
+    );
+
+    stop();
+}
+
+static void test_compact(void)
+{
+    GString *lines = g_string_new("");
+    char *content;
+
+    /* so many duplicates start the compaction in a worker thread */
+    for (int i = 0; i < 1000; i++) {
+        g_string_append(lines, "open a\nopen b\n");
+    }
+    start("", lines->str);
+    g_string_free(lines, true);
+
+    history_add(HISTORY_COMMAND, "open c", NULL);
+    ASSERT_QUERY(HISTORY_COMMAND, "open", "open c open b open a");
+
+    /* the last instance folds its shard into the file on cleanup after the
+     * running compaction is finished */
+    history_cleanup();
+    g_assert_true(g_file_get_contents(vb.files[FILES_COMMAND], &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "open a\nopen b\nopen c\n");
+    g_free(content);
+
+    history_init();
+    ASSERT_QUERY(HISTORY_COMMAND, "open", "open c open b open a");
+
+    stop();
+}
+
+static void test_shard_fold(void)
+{
+    char *sharddir, *file, *content;
+    int fd;
+
+    start("http://a.org/\tA\t1\t1500000000\n", "");
+    sharddir = g_strconcat(vb.files[FILES_HISTORY], ".d", NULL);
+
+    /* shard of an instance that is gone */
+    file = g_build_filename(sharddir, "1-00000001", NULL);
+    g_assert_true(g_file_set_contents(file, "1600000000\thttp://gone.org/\tGone\n", -1, NULL));
+    g_free(file);
+
+    /* shard of a running instance, which holds the lock */
+    file = g_build_filename(sharddir, "2-00000002", NULL);
+    g_assert_true(g_file_set_contents(file, "1600000001\thttp://live.org/\tLive\n", -1, NULL));
+    fd = open(file, O_RDONLY);
+    g_assert_cmpint(fd, !=, -1);
+    g_assert_cmpint(flock(fd, LOCK_SH), ==, 0);
+    g_free(file);
+
+    /* shard that is not locked by its instance yet */
+    file = g_build_filename(sharddir, ".3-00000003", NULL);
+    g_assert_true(g_file_set_contents(file, "1600000002\thttp://hidden.org/\n", -1, NULL));
+    g_free(file);
+
+    history_add(HISTORY_URL, "http://own.org/", "Own");
+    ASSERT_QUERY(HISTORY_URL, "org", "http://own.org/ http://live.org/ http://gone.org/ http://a.org/");
+
+    /* the shards are not folded while another instance runs */
+    history_cleanup();
+    g_assert_true(g_file_get_contents(vb.files[FILES_HISTORY], &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "http://a.org/\tA\t1\t1500000000\n");
+    g_free(content);
+
+    history_init();
+    ASSERT_QUERY(HISTORY_URL, "org", "http://own.org/ http://live.org/ http://gone.org/ http://a.org/");
+
+    /* the last instance folds all shards */
+    close(fd);
+    history_cleanup();
+    g_assert_true(g_file_get_contents(vb.files[FILES_HISTORY], &content, NULL, NULL));
+    g_assert_true(g_str_has_prefix(
+        content,
+        "http://a.org/\tA\t1\t1500000000\n"
+        "http://gone.org/\tGone\t1\t1600000000\n"
+        "http://live.org/\tLive\t1\t1600000001\n"
+        "http://own.org/\tOwn\t1\t"
+    ));
+    g_free(content);
+    content = get_dir_list(sharddir);
+    g_assert_cmpstr(content, ==, ".3-00000003");
+    g_free(content);
+
+    history_init();
+    ASSERT_QUERY(HISTORY_URL, "org", "http://own.org/ http://live.org/ http://gone.org/ http://a.org/");
+
+    g_free(sharddir);
+    stop();
+}
+
+static void test_add_uninitialized(void)
+{
+    char *content;
+
+    start("", "");
+    stop();
+
+    /* so many lines would fill the journal, but without the shard of an
+     * initialized history nothing is written */
+    for (int i = 0; i < 200; i++) {
+        history_add(HISTORY_URL, "http://www.example.org/not/initialized", "Title");
+    }
+
+    start("", "");
+    g_assert_true(g_file_get_contents(vb.files[FILES_HISTORY], &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "");
+    g_free(content);
+    ASSERT_QUERY(HISTORY_URL, "", "");
+    stop();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/test-history/index/duplicates", test_index_duplicates);
+    g_test_add_func("/test-history/index/add", test_index_add);
+    g_test_add_func("/test-history/index/max", test_index_max);
+    g_test_add_func("/test-history/trigram/query", test_trigram_query);
+    g_test_add_func("/test-history/trigram/update", test_trigram_update);
+    g_test_add_func("/test-history/frecency/legacy", test_frecency_legacy);
+    g_test_add_func("/test-history/compact", test_compact);
+    g_test_add_func("/test-history/shard/fold", test_shard_fold);
+    g_test_add_func("/test-history/add/uninitialized", test_add_uninitialized);
+
+    return g_test_run();
+}
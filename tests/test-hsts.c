@@ -0,0 +1,220 @@
+/**
+ * vimb - a webkit based vim like browser.
+ *
+ * Copyright (C) 2012-2015 Daniel Carl
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see http://www.gnu.org/licenses/.
+ */
+
+#include <gtk/gtk.h>
+#include <unistd.h>
+#include <src/main.h>
+#include <src/hsts.h>
+
+extern VbCore vb;
+
+#ifdef FEATURE_HSTS
+#define VALID   "2100-01-01T00:00:00Z"
+#define EXPIRED "2000-01-01T00:00:00Z"
+
+#define ASSERT_SECURE(provider, host, expected) \
+    g_assert_cmpint(hsts_should_secure_host(provider, host), ==, expected)
+
+/**
+ * Writes the content into the hsts file and returns a new provider that
+ * replayed it.
+ */
+static HSTSProvider *start(const char *content)
+{
+    g_assert_true(g_file_set_contents(vb.files[FILES_HSTS], content, -1, NULL));
+
+    return hsts_provider_new();
+}
+
+static void test_lookup(void)
+{
+    HSTSProvider *provider = start(
+        "a.org\t" VALID "\ty\n"
+        "b.a.org\t" VALID "\tn\n"
+        "x.a.org\t" EXPIRED "\tn\n"
+        "c.net\t" VALID "\tn\n"
+        "old.org\t" EXPIRED "\ty\n"
+        "new.old.org\t" VALID "\tn\n"
+        "bücher.example\t" VALID "\tn\n"
+        "127.0.0.1\t" VALID "\ty\n"
+        "# comment\n"
+        "\n"
+    );
+
+    /* known host and its subdomains */
+    ASSERT_SECURE(provider, "a.org", true);
+    ASSERT_SECURE(provider, "A.Org", true);
+    ASSERT_SECURE(provider, "www.a.org", true);
+    ASSERT_SECURE(provider, "b.a.org", true);
+    ASSERT_SECURE(provider, "www.b.a.org", true);
+    /* the expired entry does not hide the one of its superdomain */
+    ASSERT_SECURE(provider, "x.a.org", true);
+    ASSERT_SECURE(provider, "org", false);
+    ASSERT_SECURE(provider, "aa.org", false);
+
+    /* host without its subdomains */
+    ASSERT_SECURE(provider, "c.net", true);
+    ASSERT_SECURE(provider, "www.c.net", false);
+
+    /* expired host with a valid subdomain */
+    ASSERT_SECURE(provider, "old.org", false);
+    ASSERT_SECURE(provider, "www.old.org", false);
+    ASSERT_SECURE(provider, "new.old.org", true);
+
+    /* idn hosts are stored in their ascii form */
+    ASSERT_SECURE(provider, "bücher.example", true);
+    ASSERT_SECURE(provider, "xn--bcher-kva.example", true);
+    ASSERT_SECURE(provider, "www.bücher.example", false);
+
+    /* ip addresses are ignored */
+    ASSERT_SECURE(provider, "127.0.0.1", false);
+    ASSERT_SECURE(provider, "", false);
+
+    g_object_unref(provider);
+}
+
+static void test_tombstone(void)
+{
+    HSTSProvider *provider = start(
+        "gone.org\t" VALID "\ty\n"
+        "-gone.org\n"
+        "back.org\t" VALID "\ty\n"
+        "-back.org\n"
+        "back.org\t" VALID "\tn\n"
+        "kept.org\t" VALID "\ty\n"
+        "-sub.kept.org\n"
+        "-unknown.org\n"
+    );
+
+    ASSERT_SECURE(provider, "gone.org", false);
+    ASSERT_SECURE(provider, "www.gone.org", false);
+    /* the entry added after the tombstone replaces the removed one */
+    ASSERT_SECURE(provider, "back.org", true);
+    ASSERT_SECURE(provider, "www.back.org", false);
+    /* the tombstone of a subdomain does not remove its superdomain */
+    ASSERT_SECURE(provider, "kept.org", true);
+    ASSERT_SECURE(provider, "sub.kept.org", true);
+
+    g_object_unref(provider);
+}
+
+static void test_compact(void)
+{
+    HSTSProvider *provider;
+    GString *lines = g_string_new("");
+    char *content;
+
+    /* so many superseded entries and tombstones compact the file when the
+     * provider is finalized */
+    for (int i = 0; i < 100; i++) {
+        g_string_append(lines, "a.org\t" VALID "\tn\n-a.org\n");
+    }
+    g_string_append(lines,
+        "a.org\t" VALID "\ty\n"
+        "b.a.org\t" VALID "\tn\n"
+        "old.org\t" EXPIRED "\ty\n"
+        "gone.org\t" VALID "\ty\n"
+        "-gone.org\n"
+    );
+    provider = start(lines->str);
+    g_string_free(lines, true);
+    g_object_unref(provider);
+
+    g_assert_true(g_file_get_contents(vb.files[FILES_HSTS], &content, NULL, NULL));
+    g_assert_cmpstr(content, ==,
+        "a.org\t" VALID "\ty\n"
+        "b.a.org\t" VALID "\tn\n"
+    );
+    g_free(content);
+
+    /* the compacted file gives the same lookups */
+    provider = hsts_provider_new();
+    ASSERT_SECURE(provider, "a.org", true);
+    ASSERT_SECURE(provider, "www.a.org", true);
+    ASSERT_SECURE(provider, "b.a.org", true);
+    ASSERT_SECURE(provider, "old.org", false);
+    ASSERT_SECURE(provider, "gone.org", false);
+    g_object_unref(provider);
+
+    /* a small file is not compacted */
+    provider = start(
+        "a.org\t" VALID "\ty\n"
+        "-a.org\n"
+    );
+    g_object_unref(provider);
+    g_assert_true(g_file_get_contents(vb.files[FILES_HSTS], &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "a.org\t" VALID "\ty\n-a.org\n");
+    g_free(content);
+}
+
+static void test_preload(void)
+{
+    /* the hosts of tests/hsts-preload.txt are compiled into the library of
+     * the tests */
+    HSTSProvider *provider = start("");
+
+    ASSERT_SECURE(provider, "preload.test", true);
+    ASSERT_SECURE(provider, "www.preload.test", true);
+    ASSERT_SECURE(provider, "a.b.preload.test", true);
+    ASSERT_SECURE(provider, "exact.test", true);
+    ASSERT_SECURE(provider, "www.exact.test", false);
+    ASSERT_SECURE(provider, "mixed.case.test", true);
+    ASSERT_SECURE(provider, "WWW.MIXED.Case.Test", true);
+    ASSERT_SECURE(provider, "one.test", true);
+    ASSERT_SECURE(provider, "two.test", true);
+    ASSERT_SECURE(provider, "three.test", true);
+    ASSERT_SECURE(provider, "four.test", true);
+    ASSERT_SECURE(provider, "five.test", true);
+    ASSERT_SECURE(provider, "six.test", true);
+    ASSERT_SECURE(provider, "seven.test", true);
+    ASSERT_SECURE(provider, "eight.test", false);
+    ASSERT_SECURE(provider, "test", false);
+    ASSERT_SECURE(provider, "case.test", false);
+    ASSERT_SECURE(provider, "preload.test.org", false);
+
+    g_object_unref(provider);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    char *dir;
+    int result;
+
+    g_test_init(&argc, &argv, NULL);
+
+    dir = g_dir_make_tmp(PROJECT "-test-XXXXXX", NULL);
+    g_assert(dir);
+    vb.files[FILES_HSTS] = g_build_filename(dir, "hsts", NULL);
+
+#ifdef FEATURE_HSTS
+    g_test_add_func("/test-hsts/lookup", test_lookup);
+    g_test_add_func("/test-hsts/tombstone", test_tombstone);
+    g_test_add_func("/test-hsts/compact", test_compact);
+    g_test_add_func("/test-hsts/preload", test_preload);
+#endif
+    result = g_test_run();
+
+    unlink(vb.files[FILES_HSTS]);
+    rmdir(dir);
+    g_free(vb.files[FILES_HSTS]);
+    g_free(dir);
+
+    return result;
+}
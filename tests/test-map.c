@@ -103,6 +103,21 @@ static void test_handle_string_overrule(void)
     ASSERT_MAPPING("a", "overruled");
 }
 
+static void test_handle_string_longest(void)
+{
+    map_insert("fo", "[fo]", 't', false);
+    /* the longest complete map is used if no longer one is possible */
+    ASSERT_MAPPING("foz", "[fo]z");
+
+    /* without the longer map the shorter one is complete */
+    map_delete("foobar", 't');
+    ASSERT_MAPPING("foo", "[fo]o");
+
+    map_insert("foobar", "[baz]", 't', false);
+    map_delete("fo", 't');
+    ASSERT_MAPPING("foz", "foz");
+}
+
 static void test_remove(void)
 {
     map_insert("x", "[x]", 't', false);
@@ -155,6 +170,7 @@ int main(int argc, char *argv[])
     g_test_add_func("/test-map/handle_string/alias", test_handle_string_alias);
     g_test_add_func("/test-map/handle_string/remapped", test_handle_string_remapped);
     g_test_add_func("/test-map/handle_string/overrule", test_handle_string_overrule);
+    g_test_add_func("/test-map/handle_string/longest", test_handle_string_longest);
     g_test_add_func("/test-map/remove", test_remove);
     g_test_add_func("/test-map/keypress/single-char", test_keypress_single);
     g_test_add_func("/test-map/keypress/sequence", test_keypress_sequence);
@@ -18,6 +18,8 @@
  */
 
 #include <gtk/gtk.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <src/util.h>
 
 extern VbCore vb;
@@ -263,6 +265,258 @@ static void test_wildmatch_multi(void)
     g_assert_false(util_wildmatch("foo,?", "fo"));
 }
 
+static void test_wildmatch_compiled(void)
+{
+    UtilWildmatch *matcher;
+    GString *subject;
+
+    /* a compiled pattern can be used for many subjects */
+    matcher = util_wildmatch_compile("http{s,}://*.io/*,about:blank");
+    g_assert_nonnull(matcher);
+    g_assert_true(util_wildmatch_exec(matcher, "http://fanglingsu.github.io/vimb/"));
+    g_assert_true(util_wildmatch_exec(matcher, "https://fanglingsu.github.io/"));
+    g_assert_true(util_wildmatch_exec(matcher, "about:blank"));
+    g_assert_false(util_wildmatch_exec(matcher, "ftp://fanglingsu.github.io/"));
+    g_assert_false(util_wildmatch_exec(matcher, "about:blanks"));
+    g_assert_false(util_wildmatch_exec(matcher, ""));
+    util_wildmatch_free(matcher);
+
+    /* no list item matches - the rest of the pattern must not be tried */
+    g_assert_false(util_wildmatch("{a}", ""));
+    g_assert_false(util_wildmatch("{foo,bar}", ""));
+    g_assert_false(util_wildmatch("x{foo,bar}y", "xy"));
+    /* backslash before none special char does not match any char */
+    g_assert_false(util_wildmatch("one\\two", "oneXtwo"));
+
+    /* many wildcards on a long subject must not backtrack exponentially */
+    subject = g_string_new(NULL);
+    for (int i = 0; i < 10000; i++) {
+        g_string_append_c(subject, 'a');
+    }
+    g_assert_false(util_wildmatch("*a*a*a*a*a*a*a*a*b", subject->str));
+    g_string_append_c(subject, 'b');
+    g_assert_true(util_wildmatch("*a*a*a*a*a*a*a*a*b", subject->str));
+    g_string_free(subject, true);
+}
+
+static void test_wildmatch_all(void)
+{
+    const char *patterns[] = {"*.io/*", "http{s,}://*", "", "}", "*://*/vimb/"};
+    gboolean matches[LENGTH(patterns)];
+    UtilWildmatch *matcher;
+
+    matcher = util_wildmatch_compile_all(patterns, LENGTH(patterns));
+    g_assert_true(util_wildmatch_exec_all(matcher, "https://fanglingsu.github.io/vimb/", matches));
+    g_assert_true(matches[0]);
+    g_assert_true(matches[1]);
+    g_assert_false(matches[2]);
+    g_assert_false(matches[3]);
+    g_assert_true(matches[4]);
+
+    g_assert_true(util_wildmatch_exec_all(matcher, "", matches));
+    g_assert_false(matches[0]);
+    g_assert_false(matches[1]);
+    g_assert_true(matches[2]);
+    g_assert_false(matches[3]);
+    g_assert_false(matches[4]);
+
+    g_assert_false(util_wildmatch_exec_all(matcher, "ftp://example.org/", matches));
+    for (int i = 0; i < LENGTH(patterns); i++) {
+        g_assert_false(matches[i]);
+    }
+    util_wildmatch_free(matcher);
+}
+
+static void test_wildmatch_split(void)
+{
+    char **parts = util_wildmatch_split("foo,,b{a,o}r,ba\\,z,");
+
+    g_assert_cmpint(g_strv_length(parts), ==, 3);
+    g_assert_cmpstr(parts[0], ==, "foo");
+    g_assert_cmpstr(parts[1], ==, "b{a,o}r");
+    g_assert_cmpstr(parts[2], ==, "ba\\,z");
+    g_strfreev(parts);
+
+    parts = util_wildmatch_split("");
+    g_assert_null(parts[0]);
+    g_strfreev(parts);
+}
+
+static void test_file_read_new(void)
+{
+    UtilFileState state = {0};
+    UtilFileChange change;
+    char *file, *content;
+    FILE *f;
+
+    g_assert_true(util_create_tmp_file("one\ntwo\n", &file));
+
+    /* first read returns the whole file */
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_APPENDED);
+    g_assert_cmpstr(content, ==, "one\ntwo\n");
+    g_free(content);
+
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_UNCHANGED);
+    g_assert_null(content);
+
+    /* partial written lines are not returned */
+    util_file_append(file, "three\nfour");
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_APPENDED);
+    g_assert_cmpstr(content, ==, "three\n");
+    g_free(content);
+
+    util_file_append(file, "\n");
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpstr(content, ==, "four\n");
+    g_free(content);
+
+    /* rewritten file with more content than already read */
+    f = fopen(file, "w");
+    fputs("five\nsix\nseven\neight\nnine\n", f);
+    fclose(f);
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_REPLACED);
+    g_assert_cmpstr(content, ==, "five\nsix\nseven\neight\nnine\n");
+    g_free(content);
+
+    /* truncated file */
+    f = fopen(file, "w");
+    fclose(f);
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_REPLACED);
+    g_assert_null(content);
+
+    unlink(file);
+    g_free(file);
+}
+
+static void test_file_replace(void)
+{
+    UtilFileState state = {0};
+    UtilFileChange change;
+    char *file, *content;
+
+    g_assert_true(util_create_tmp_file("one\none\ntwo\n", &file));
+    g_free(util_file_read_new(file, &state, &change));
+
+    g_assert_true(util_file_replace(file, "one\ntwo\n", 8, &state));
+    g_assert_true(g_file_get_contents(file, &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "one\ntwo\n");
+    g_free(content);
+
+    /* the state covers the new file so only appended lines are read */
+    util_file_append(file, "three\n");
+    content = util_file_read_new(file, &state, &change);
+    g_assert_cmpint(change, ==, UTIL_FILE_APPENDED);
+    g_assert_cmpstr(content, ==, "three\n");
+    g_free(content);
+
+    /* file changed since last read is not replaced */
+    util_file_append(file, "four\n");
+    g_assert_false(util_file_replace(file, "one\n", 4, &state));
+    g_assert_true(g_file_get_contents(file, &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "one\ntwo\nthree\nfour\n");
+    g_free(content);
+
+    unlink(file);
+    g_free(file);
+}
+
+typedef struct {
+    char          *file;
+    UtilFileState state;
+} ReplaceData;
+
+static gpointer replace_thread(ReplaceData *data)
+{
+    return GINT_TO_POINTER(util_file_replace(data->file, "one\n", 4, &data->state));
+}
+
+static void test_file_replace_locked(void)
+{
+    ReplaceData data = {NULL, {0}};
+    UtilFileChange change;
+    GThread *thread;
+    struct stat st;
+    char *content;
+    int fd;
+
+    g_assert_true(util_create_tmp_file("one\none\n", &data.file));
+    g_assert_cmpint(chmod(data.file, 0640), ==, 0);
+    g_free(util_file_read_new(data.file, &data.state, &change));
+
+    /* the replaced file keeps its permissions */
+    g_assert_true(util_file_replace(data.file, "one\n", 4, &data.state));
+    g_assert_cmpint(stat(data.file, &st), ==, 0);
+    g_assert_cmpint(st.st_mode & 07777, ==, 0640);
+
+    /* line appended after the file was read but before it is replaced */
+    g_assert_true(util_file_append(data.file, "two\n"));
+    g_free(util_file_read_new(data.file, &data.state, &change));
+    fd     = util_file_lock(data.file);
+    g_assert_cmpint(fd, !=, -1);
+    thread = g_thread_new("replace", (GThreadFunc)replace_thread, &data);
+    /* give the replacement the time to wait for the lock */
+    g_usleep(G_USEC_PER_SEC / 10);
+    g_assert_cmpint(write(fd, "three\n", 6), ==, 6);
+    close(fd);
+    g_assert_false(GPOINTER_TO_INT(g_thread_join(thread)));
+
+    g_assert_true(g_file_get_contents(data.file, &content, NULL, NULL));
+    g_assert_cmpstr(content, ==, "one\ntwo\nthree\n");
+    g_free(content);
+
+    unlink(data.file);
+    g_free(data.file);
+}
+
+static void test_lines(void)
+{
+    UtilLines lines;
+    const char *line;
+    gsize len;
+    char *file;
+
+    g_assert_true(util_create_tmp_file("one\n\n  three \nfour", &file));
+
+    g_assert_true(util_lines_open(&lines, file));
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_cmpint(len, ==, 3);
+    g_assert_true(!strncmp(line, "one", len));
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_cmpint(len, ==, 0);
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_cmpint(len, ==, 8);
+    g_assert_true(!strncmp(line, "  three ", len));
+    /* the last line needs no newline */
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_cmpint(len, ==, 4);
+    g_assert_true(!strncmp(line, "four", len));
+    g_assert_false(util_lines_next(&lines, &line, &len));
+    util_lines_close(&lines);
+
+    /* the final newline does not start an empty line */
+    g_file_set_contents(file, "one\ntwo\n", -1, NULL);
+    g_assert_true(util_lines_open(&lines, file));
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_true(util_lines_next(&lines, &line, &len));
+    g_assert_true(!strncmp(line, "two", len));
+    g_assert_false(util_lines_next(&lines, &line, &len));
+    util_lines_close(&lines);
+
+    /* empty file */
+    g_file_set_contents(file, "", -1, NULL);
+    g_assert_true(util_lines_open(&lines, file));
+    g_assert_false(util_lines_next(&lines, &line, &len));
+    util_lines_close(&lines);
+
+    unlink(file);
+    g_free(file);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
@@ -280,6 +534,13 @@ int main(int argc, char *argv[])
     g_test_add_func("/test-util/wildmatch-curlybraces", test_wildmatch_curlybraces);
     g_test_add_func("/test-util/wildmatch-complete", test_wildmatch_complete);
     g_test_add_func("/test-util/wildmatch-multi", test_wildmatch_multi);
+    g_test_add_func("/test-util/wildmatch-compiled", test_wildmatch_compiled);
+    g_test_add_func("/test-util/wildmatch-all", test_wildmatch_all);
+    g_test_add_func("/test-util/wildmatch-split", test_wildmatch_split);
+    g_test_add_func("/test-util/file-read-new", test_file_read_new);
+    g_test_add_func("/test-util/file-replace", test_file_replace);
+    g_test_add_func("/test-util/file-replace-locked", test_file_replace_locked);
+    g_test_add_func("/test-util/lines", test_lines);
 
     return g_test_run();
 }